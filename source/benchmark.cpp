@@ -0,0 +1,393 @@
+#include "zimg_helper.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// throughput benchmark of resizing and format conversion
+// usage: benchmark [--res thumb,1080p] [--pixel byte,word,float] [--filter bicubic,lanczos]
+//     [--convert none,yuv] [--threads 1,4] [--cpu none,auto,auto64] [--scale 0.5]
+//     [--min-time 0.5] [--output result.json]
+// each list option takes comma-separated names, and every combination of them is measured
+// graph building, copy-in (deinterleave from packed HWC), processing and copy-out (interleave to packed HWC)
+// are timed separately, the medians of the iterations are reported
+
+struct Resolution
+{
+	const char *name;
+	unsigned width;
+	unsigned height;
+};
+
+struct PixelType
+{
+	const char *name;
+	zimg_pixel_type_e type;
+	unsigned depth;
+};
+
+struct Filter
+{
+	const char *name;
+	zimg_resample_filter_e filter;
+};
+
+struct CpuType
+{
+	const char *name;
+	zimg_cpu_type_e cpu;
+};
+
+const Resolution RESOLUTIONS[] = {
+	{ "thumb", 320, 180 }, { "480p", 854, 480 }, { "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 }, { "4k", 3840, 2160 }, { "8k", 7680, 4320 } };
+const PixelType PIXEL_TYPES[] = {
+	{ "byte", ZIMG_PIXEL_BYTE, 8 }, { "word", ZIMG_PIXEL_WORD, 16 }, { "float", ZIMG_PIXEL_FLOAT, 32 } };
+const Filter FILTERS[] = {
+	{ "point", ZIMG_RESIZE_POINT }, { "bilinear", ZIMG_RESIZE_BILINEAR }, { "bicubic", ZIMG_RESIZE_BICUBIC },
+	{ "spline16", ZIMG_RESIZE_SPLINE16 }, { "spline36", ZIMG_RESIZE_SPLINE36 }, { "spline64", ZIMG_RESIZE_SPLINE64 },
+	{ "lanczos", ZIMG_RESIZE_LANCZOS } };
+const CpuType CPU_TYPES[] = {
+	{ "none", ZIMG_CPU_NONE }, { "auto", ZIMG_CPU_AUTO }, { "auto64", ZIMG_CPU_AUTO_64B } };
+const char *const CONVERTS[] = { "none", "yuv" };
+
+// a single combination of the sweep
+struct Case
+{
+	const Resolution *res;
+	const PixelType *pixel;
+	const Filter *filter;
+	const char *convert;
+	unsigned threads;
+	const CpuType *cpu;
+};
+
+struct Result
+{
+	Case c;
+	unsigned dst_width;
+	unsigned dst_height;
+	unsigned bands;
+	size_t iterations;
+	double build_ms;
+	double copy_in_ms;
+	double process_ms;
+	double copy_out_ms;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed_ms(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	const size_t n = values.size();
+	return n == 0 ? 0 : n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// split a comma-separated list
+static std::vector<std::string> split(const std::string &list)
+{
+	std::vector<std::string> items;
+	size_t begin = 0;
+	for (size_t end; (end = list.find(',', begin)) != std::string::npos; begin = end + 1)
+	{
+		items.push_back(list.substr(begin, end - begin));
+	}
+	items.push_back(list.substr(begin));
+	return items;
+}
+
+// select the entries of a table by their names
+template<typename T, size_t N>
+static std::vector<const T *> select(const T (&table)[N], const std::string &list, const char *option)
+{
+	std::vector<const T *> selected;
+	for (const std::string &name : split(list))
+	{
+		const T *found = nullptr;
+		for (const T &entry : table)
+		{
+			if (name == entry.name) found = &entry;
+		}
+		if (!found)
+		{
+			std::cerr << "unknown value for " << option << ": " << name << std::endl;
+			std::exit(1);
+		}
+		selected.push_back(found);
+	}
+	return selected;
+}
+
+// fill the packed source with deterministic noise in the valid range
+template<typename T>
+static void fill_noise(std::vector<T> &data, unsigned depth)
+{
+	uint32_t state = 12345;
+	for (T &value : data)
+	{
+		state = state * 1664525 + 1013904223;
+		const uint32_t bits = state >> 8;
+		value = depth > 16 ? static_cast<T>(bits / 16777216.0) : static_cast<T>(bits & ((1U << depth) - 1));
+	}
+}
+
+template<typename T>
+static Result run_case(const Case &c, double scale, double min_time)
+{
+	Result result = {};
+	result.c = c;
+	const unsigned sw = c.res->width;
+	const unsigned sh = c.res->height;
+	const unsigned dw = std::max(1U, static_cast<unsigned>(sw * scale + 0.5));
+	const unsigned dh = std::max(1U, static_cast<unsigned>(sh * scale + 0.5));
+	const bool yuv = std::string(c.convert) == "yuv";
+	result.dst_width = dw;
+	result.dst_height = dh;
+
+	// formats, RGB to RGB or YUV (BT.709)
+	ZFilter::Zformat src_format;
+	src_format.width = sw;
+	src_format.height = sh;
+	src_format.pixel_type = c.pixel->type;
+	src_format.depth = c.pixel->depth;
+	src_format.color_family = ZIMG_COLOR_RGB;
+	src_format.pixel_range = ZIMG_RANGE_FULL;
+	src_format.matrix_coefficients = ZIMG_MATRIX_RGB;
+	src_format.transfer_characteristics = ZIMG_TRANSFER_BT709;
+	src_format.color_primaries = ZIMG_PRIMARIES_BT709;
+	ZFilter::Zformat dst_format = src_format;
+	dst_format.width = dw;
+	dst_format.height = dh;
+	if (yuv)
+	{
+		dst_format.color_family = ZIMG_COLOR_YUV;
+		dst_format.matrix_coefficients = ZIMG_MATRIX_BT709;
+	}
+	ZFilter::Zparams params;
+	params.resample_filter = params.resample_filter_uv = c.filter->filter;
+	params.cpu_type = c.cpu->cpu;
+
+	// graph building
+	Clock::time_point start = Clock::now();
+	ZFilter zfilter(src_format, dst_format, params);
+	result.bands = zfilter.setBands(c.threads);
+	result.build_ms = elapsed_ms(start);
+
+	// buffers
+	const bool simd = c.cpu->cpu != ZIMG_CPU_NONE;
+	std::vector<T> src_packed(static_cast<size_t>(sw) * sh * 3);
+	std::vector<T> dst_packed(static_cast<size_t>(dw) * dh * 3);
+	fill_noise(src_packed, c.pixel->depth);
+	Image<T> src(ImagePlane<T>(sw, sh), ImagePlane<T>(sw, sh), ImagePlane<T>(sw, sh));
+	Image<T> dst(ImagePlane<T>(dw, dh), ImagePlane<T>(dw, dh), ImagePlane<T>(dw, dh));
+	T *src_planes[MAX_PLANES];
+	const T *dst_planes[MAX_PLANES];
+	std::ptrdiff_t src_strides[MAX_PLANES];
+	std::ptrdiff_t dst_strides[MAX_PLANES];
+	for (int p = 0; p < MAX_PLANES; ++p)
+	{
+		src_planes[p] = src.getData(p);
+		src_strides[p] = src.getStride(p);
+		dst_planes[p] = dst.getData(p);
+		dst_strides[p] = dst.getStride(p);
+	}
+
+	// iterations, the first one warms up caches and page mappings
+	std::vector<double> copy_in, process, copy_out;
+	double total = 0;
+	for (size_t i = 0; i == 0 || i < 4 || (total < min_time * 1000 && i < 1000); ++i)
+	{
+		start = Clock::now();
+		deinterleave(src_planes, src_strides, src_packed.data(), sw * 3 * sizeof(T), 3, sw, sh, simd);
+		const double t_in = elapsed_ms(start);
+		start = Clock::now();
+		zfilter(dst, src);
+		const double t_process = elapsed_ms(start);
+		start = Clock::now();
+		interleave(dst_packed.data(), dw * 3 * sizeof(T), dst_planes, dst_strides, 3, dw, dh, simd);
+		const double t_out = elapsed_ms(start);
+		if (i == 0) continue;
+		copy_in.push_back(t_in);
+		process.push_back(t_process);
+		copy_out.push_back(t_out);
+		total += t_in + t_process + t_out;
+	}
+	result.iterations = process.size();
+	result.copy_in_ms = median(copy_in);
+	result.process_ms = median(process);
+	result.copy_out_ms = median(copy_out);
+	return result;
+}
+
+// throughput in megapixels per second, 0 when the time is below the clock resolution
+static double mpix_s(double pixels, double ms)
+{
+	return ms > 0 ? pixels / ms / 1000 : 0;
+}
+
+// throughput as a JSON number, null when it can't be measured
+static std::string json_mpix_s(double pixels, double ms)
+{
+	if (ms <= 0) return "null";
+	std::ostringstream value;
+	value << mpix_s(pixels, ms);
+	return value.str();
+}
+
+static void write_json(std::ostream &out, const std::vector<Result> &results, double scale)
+{
+	char date[32];
+	const std::time_t now = std::time(nullptr);
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+	out << "{\n";
+	out << "  \"date\": \"" << date << "\",\n";
+	out << "  \"zimg_api_version\": " << zimg_get_api_version(nullptr, nullptr) << ",\n";
+	out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+	out << "  \"scale\": " << scale << ",\n";
+	out << "  \"results\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result &r = results[i];
+		const double src_pixels = static_cast<double>(r.c.res->width) * r.c.res->height;
+		const double dst_pixels = static_cast<double>(r.dst_width) * r.dst_height;
+		out << (i ? ",\n" : "\n") << "    {"
+			<< "\"res\": \"" << r.c.res->name << "\", "
+			<< "\"src_width\": " << r.c.res->width << ", \"src_height\": " << r.c.res->height << ", "
+			<< "\"dst_width\": " << r.dst_width << ", \"dst_height\": " << r.dst_height << ", "
+			<< "\"pixel\": \"" << r.c.pixel->name << "\", "
+			<< "\"filter\": \"" << r.c.filter->name << "\", "
+			<< "\"convert\": \"" << r.c.convert << "\", "
+			<< "\"threads\": " << r.c.threads << ", \"bands\": " << r.bands << ", "
+			<< "\"cpu\": \"" << r.c.cpu->name << "\", "
+			<< "\"iterations\": " << r.iterations << ", "
+			<< "\"build_ms\": " << r.build_ms << ", "
+			<< "\"copy_in_ms\": " << r.copy_in_ms << ", "
+			<< "\"process_ms\": " << r.process_ms << ", "
+			<< "\"copy_out_ms\": " << r.copy_out_ms << ", "
+			<< "\"process_mpix_s\": " << json_mpix_s(dst_pixels, r.process_ms) << ", "
+			<< "\"process_ns_per_pixel\": " << r.process_ms * 1e6 / dst_pixels << ", "
+			<< "\"copy_in_ns_per_pixel\": " << r.copy_in_ms * 1e6 / src_pixels << ", "
+			<< "\"copy_out_ns_per_pixel\": " << r.copy_out_ms * 1e6 / dst_pixels << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+	// options
+	std::string res = "thumb,480p,720p,1080p,4k,8k";
+	std::string pixel = "byte,word,float";
+	std::string filter = "bicubic";
+	std::string convert = "none,yuv";
+	std::string threads = "1";
+	std::string cpu = "auto";
+	std::string output;
+	double scale = 0.5;
+	double min_time = 0.5;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			std::cerr << "missing value for " << arg << std::endl;
+			return 1;
+		}
+		const std::string value = argv[++i];
+		if (arg == "--res") res = value;
+		else if (arg == "--pixel") pixel = value;
+		else if (arg == "--filter") filter = value;
+		else if (arg == "--convert") convert = value;
+		else if (arg == "--threads") threads = value;
+		else if (arg == "--cpu") cpu = value;
+		else if (arg == "--scale") scale = std::atof(value.c_str());
+		else if (arg == "--min-time") min_time = std::atof(value.c_str());
+		else if (arg == "--output") output = value;
+		else
+		{
+			std::cerr << "unknown option: " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (scale <= 0)
+	{
+		std::cerr << "scale must be positive" << std::endl;
+		return 1;
+	}
+
+	const auto res_list = select(RESOLUTIONS, res, "--res");
+	const auto pixel_list = select(PIXEL_TYPES, pixel, "--pixel");
+	const auto filter_list = select(FILTERS, filter, "--filter");
+	const auto cpu_list = select(CPU_TYPES, cpu, "--cpu");
+	std::vector<const char *> convert_list;
+	for (const std::string &name : split(convert))
+	{
+		auto found = std::find_if(std::begin(CONVERTS), std::end(CONVERTS),
+			[&](const char *entry) { return name == entry; });
+		if (found == std::end(CONVERTS))
+		{
+			std::cerr << "unknown value for --convert: " << name << std::endl;
+			return 1;
+		}
+		convert_list.push_back(*found);
+	}
+	std::vector<unsigned> threads_list;
+	for (const std::string &name : split(threads))
+	{
+		threads_list.push_back(static_cast<unsigned>(std::atoi(name.c_str())));
+	}
+
+	// sweep
+	std::vector<Result> results;
+	std::printf("%-6s %-6s %-9s %-8s %4s %5s %-7s %9s %9s %9s %9s %9s\n", "res", "pixel", "filter", "convert",
+		"thr", "bands", "cpu", "build_ms", "in_ms", "proc_ms", "out_ms", "Mpix/s");
+	for (const Resolution *r : res_list)
+	for (const PixelType *p : pixel_list)
+	for (const Filter *f : filter_list)
+	for (const char *v : convert_list)
+	for (unsigned t : threads_list)
+	for (const CpuType *u : cpu_list)
+	{
+		const Case c = { r, p, f, v, t, u };
+		Result result;
+		try
+		{
+			result = p->type == ZIMG_PIXEL_BYTE ? run_case<uint8_t>(c, scale, min_time)
+				: p->type == ZIMG_PIXEL_WORD ? run_case<uint16_t>(c, scale, min_time)
+				: run_case<float>(c, scale, min_time);
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << "failed " << r->name << " " << p->name << " " << f->name << ": " << e.what() << std::endl;
+			continue;
+		}
+		std::printf("%-6s %-6s %-9s %-8s %4u %5u %-7s %9.3f %9.3f %9.3f %9.3f %9.1f\n", r->name, p->name, f->name, v,
+			t, result.bands, u->name, result.build_ms, result.copy_in_ms, result.process_ms, result.copy_out_ms,
+			mpix_s(static_cast<double>(result.dst_width) * result.dst_height, result.process_ms));
+		std::fflush(stdout);
+		results.push_back(result);
+	}
+
+	// report
+	if (!output.empty())
+	{
+		std::ofstream file(output);
+		if (!file)
+		{
+			std::cerr << "failed to open " << output << std::endl;
+			return 1;
+		}
+		write_json(file, results, scale);
+	}
+	return 0;
+}
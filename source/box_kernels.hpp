@@ -0,0 +1,229 @@
+#pragma once
+
+#include "copy_kernels.hpp"
+
+// area average of integer factor blocks, used to pre-reduce large downscales before the resize graph
+// integer pixels are rounded to nearest, float pixels are multiplied by the reciprocal of the block area
+
+template<typename T>
+struct BoxTraits
+{
+	typedef uint32_t Tsum;
+	static T average(Tsum sum, unsigned count) { return static_cast<T>((sum + count / 2) / count); }
+};
+
+template<>
+struct BoxTraits<float>
+{
+	typedef float Tsum;
+	static float average(Tsum sum, unsigned count) { return sum * (1.0f / count); }
+};
+
+////////
+// scalar kernels
+
+// average the blocks of F x F elements of F rows into one row of width elements
+// note that the stride is based on BYTES
+template<typename T, int F>
+static inline void box_row_c(T *dst, const T *src, std::ptrdiff_t src_stride, size_t width)
+{
+	typedef typename BoxTraits<T>::Tsum Tsum;
+	for (size_t w = 0; w < width; ++w)
+	{
+		Tsum sum = 0;
+		for (int i = 0; i < F; ++i)
+		{
+			const T *row = reinterpret_cast<const T *>(reinterpret_cast<const uint8_t *>(src) + i * src_stride) + w * F;
+			for (int j = 0; j < F; ++j)
+			{
+				sum += row[j];
+			}
+		}
+		dst[w] = BoxTraits<T>::average(sum, F * F);
+	}
+}
+
+////////
+// SSE2 kernels
+// the columns are summed vertically first, then the adjacent sums are added pairwise,
+// once for F=2 and twice for F=4
+
+#ifdef ZIMGAPP_X86
+// pairwise sums of the 32-bit lanes of a and b, the sums of a come first
+ZIMGAPP_TARGET_SSE2
+static inline __m128i box_pairs_epi32(__m128i a, __m128i b)
+{
+	const __m128 fa = _mm_castsi128_ps(a);
+	const __m128 fb = _mm_castsi128_ps(b);
+	return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+		_mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+ZIMGAPP_TARGET_SSE2
+static inline __m128 box_pairs_ps(__m128 a, __m128 b)
+{
+	return _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+// return the number of elements processed, the remaining ones are left to the scalar kernel
+// 8 elements per iteration, the column sums are 16-bit lanes as they stay below 4 * 255
+template<int F>
+ZIMGAPP_TARGET_SSE2
+static size_t box_row_sse2(uint8_t *dst, const uint8_t *src, std::ptrdiff_t src_stride, size_t width)
+{
+	const size_t step = 8;
+	const size_t upper = width / step * step;
+	const int shift = F == 4 ? 4 : 2;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i round = _mm_set1_epi32(F * F / 2);
+
+	for (size_t w = 0; w < upper; w += step)
+	{
+		__m128i col[4]; // only the first F are used
+		for (int k = 0; k < 4; ++k) col[k] = zero;
+		for (int i = 0; i < F; ++i)
+		{
+			const __m128i *row = reinterpret_cast<const __m128i *>(src + i * src_stride + w * F);
+			for (int k = 0; k < F / 2; ++k)
+			{
+				const __m128i in = _mm_loadu_si128(row + k);
+				col[2 * k] = _mm_add_epi16(col[2 * k], _mm_unpacklo_epi8(in, zero));
+				col[2 * k + 1] = _mm_add_epi16(col[2 * k + 1], _mm_unpackhi_epi8(in, zero));
+			}
+		}
+		__m128i sum[2];
+		for (int k = 0; k < 2; ++k)
+		{
+			if (F == 4) // the pair sums stay below 8 * 255, thus they can be packed again for a second pass
+			{
+				sum[k] = _mm_madd_epi16(_mm_packs_epi32(_mm_madd_epi16(col[2 * k], ones),
+					_mm_madd_epi16(col[2 * k + 1], ones)), ones);
+			}
+			else
+			{
+				sum[k] = _mm_madd_epi16(col[k], ones);
+			}
+			sum[k] = _mm_srli_epi32(_mm_add_epi32(sum[k], round), shift);
+		}
+		const __m128i out = _mm_packs_epi32(sum[0], sum[1]);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(dst + w), _mm_packus_epi16(out, out));
+	}
+	return upper;
+}
+
+// 4 elements per iteration, the column sums are 32-bit lanes
+template<int F>
+ZIMGAPP_TARGET_SSE2
+static size_t box_row_sse2(uint16_t *dst, const uint16_t *src, std::ptrdiff_t src_stride, size_t width)
+{
+	const size_t step = 4;
+	const size_t upper = width / step * step;
+	const int shift = F == 4 ? 4 : 2;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(F * F / 2);
+	// SSE2 has no unsigned saturation from 32-bit, the values are offset into the signed range
+	const __m128i offset32 = _mm_set1_epi32(0x8000);
+	const __m128i offset16 = _mm_set1_epi16(-0x8000);
+
+	for (size_t w = 0; w < upper; w += step)
+	{
+		__m128i col[F];
+		for (int k = 0; k < F; ++k) col[k] = zero;
+		for (int i = 0; i < F; ++i)
+		{
+			const uint16_t *row16 = reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(src) + i * src_stride) + w * F;
+			const __m128i *row = reinterpret_cast<const __m128i *>(row16);
+			for (int k = 0; k < F / 2; ++k)
+			{
+				const __m128i in = _mm_loadu_si128(row + k);
+				col[2 * k] = _mm_add_epi32(col[2 * k], _mm_unpacklo_epi16(in, zero));
+				col[2 * k + 1] = _mm_add_epi32(col[2 * k + 1], _mm_unpackhi_epi16(in, zero));
+			}
+		}
+		__m128i sum = F == 4
+			? box_pairs_epi32(box_pairs_epi32(col[0], col[1]), box_pairs_epi32(col[F / 2], col[F - 1]))
+			: box_pairs_epi32(col[0], col[F - 1]);
+		sum = _mm_sub_epi32(_mm_srli_epi32(_mm_add_epi32(sum, round), shift), offset32);
+		const __m128i out = _mm_xor_si128(_mm_packs_epi32(sum, sum), offset16);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(dst + w), out);
+	}
+	return upper;
+}
+
+// 4 elements per iteration
+template<int F>
+ZIMGAPP_TARGET_SSE2
+static size_t box_row_sse2(float *dst, const float *src, std::ptrdiff_t src_stride, size_t width)
+{
+	const size_t step = 4;
+	const size_t upper = width / step * step;
+	const __m128 scale = _mm_set1_ps(1.0f / (F * F));
+
+	for (size_t w = 0; w < upper; w += step)
+	{
+		__m128 col[F];
+		for (int k = 0; k < F; ++k) col[k] = _mm_setzero_ps();
+		for (int i = 0; i < F; ++i)
+		{
+			const float *row = reinterpret_cast<const float *>(reinterpret_cast<const uint8_t *>(src) + i * src_stride) + w * F;
+			for (int k = 0; k < F; ++k)
+			{
+				col[k] = _mm_add_ps(col[k], _mm_loadu_ps(row + k * 4));
+			}
+		}
+		const __m128 sum = F == 4
+			? box_pairs_ps(box_pairs_ps(col[0], col[1]), box_pairs_ps(col[F / 2], col[F - 1]))
+			: box_pairs_ps(col[0], col[F - 1]);
+		_mm_storeu_ps(dst + w, _mm_mul_ps(sum, scale));
+	}
+	return upper;
+}
+#endif
+
+////////
+// dispatchers
+
+// average the blocks of F x F elements of F rows into one row of width elements
+// simd=false forces the scalar kernel
+template<typename T, int F>
+static inline void box_row(T *dst, const T *src, std::ptrdiff_t src_stride, size_t width, bool simd = true)
+{
+	size_t done = 0;
+#ifdef ZIMGAPP_X86
+	if (simd && CpuFeatures::get().sse2)
+	{
+		done = box_row_sse2<F>(dst, src, src_stride, width);
+	}
+#endif
+	if (done < width)
+	{
+		box_row_c<T, F>(dst + done, src + done * F, src_stride, width - done);
+	}
+}
+
+// average the blocks of factor x factor elements of a 2D array into a 2D array of width x height elements,
+// the source should hold (width * factor) x (height * factor) elements
+// note that strides are based on BYTES, the factor is dispatched at runtime
+// return false if the factor is not supported
+template<typename T>
+static inline bool box_reduce(T *dst, std::ptrdiff_t dst_stride,
+	const T *src, std::ptrdiff_t src_stride, unsigned factor, size_t width, size_t height, bool simd = true)
+{
+	if (factor != 2 && factor != 4)
+	{
+		return false;
+	}
+	for (size_t h = 0; h < height; ++h)
+	{
+		T *dst_row = reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(dst) + h * dst_stride);
+		const T *src_row = reinterpret_cast<const T *>(reinterpret_cast<const uint8_t *>(src) + h * factor * src_stride);
+
+		switch (factor)
+		{
+		case 2: box_row<T, 2>(dst_row, src_row, src_stride, width, simd); break;
+		case 4: box_row<T, 4>(dst_row, src_row, src_stride, width, simd); break;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,481 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ZIMGAPP_X86
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// SIMD functions are compiled for the specified instruction set without global compiler flags,
+// and only called after the CPU features are checked at runtime
+#if defined(ZIMGAPP_X86) && defined(__GNUC__)
+#define ZIMGAPP_TARGET_SSE2 __attribute__((target("sse2")))
+#define ZIMGAPP_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define ZIMGAPP_TARGET_SSE2
+#define ZIMGAPP_TARGET_SSSE3
+#endif
+
+// copies of the output of at least this size in bytes use non-temporal stores,
+// as they would evict most of the last level cache, including the zimg temporary buffer
+const size_t STREAM_COPY_MIN = size_t(4) << 20;
+
+// instruction sets supported by the running CPU
+struct CpuFeatures
+{
+	bool sse2 = false;
+	bool ssse3 = false;
+
+	static const CpuFeatures &get()
+	{
+		static const CpuFeatures features = detect();
+		return features;
+	}
+
+protected:
+	static CpuFeatures detect()
+	{
+		CpuFeatures features;
+#ifdef ZIMGAPP_X86
+		unsigned regs[4] = {};
+#ifdef _MSC_VER
+		__cpuid(reinterpret_cast<int *>(regs), 1);
+#else
+		__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+		features.sse2 = (regs[3] & (1U << 26)) != 0;
+		features.ssse3 = (regs[2] & (1U << 9)) != 0;
+#endif
+		return features;
+	}
+};
+
+////////
+// scalar kernels
+
+// split one row of N interleaved channels into N planes
+template<typename T, int N>
+static inline void deinterleave_row_c(T *const *dst, const T *src, size_t width)
+{
+	for (size_t w = 0; w < width; ++w, src += N)
+	{
+		for (int c = 0; c < N; ++c)
+		{
+			dst[c][w] = src[c];
+		}
+	}
+}
+
+// merge one row of N planes into N interleaved channels
+template<typename T, int N>
+static inline void interleave_row_c(T *dst, const T *const *src, size_t width)
+{
+	for (size_t w = 0; w < width; ++w, dst += N)
+	{
+		for (int c = 0; c < N; ++c)
+		{
+			dst[c] = src[c][w];
+		}
+	}
+}
+
+// copy every N-th element of a row into a continuous row
+template<typename T, int N>
+static inline void gather_row_c(T *dst, const T *src, size_t width)
+{
+	for (size_t w = 0; w < width; ++w)
+	{
+		dst[w] = src[w * N];
+	}
+}
+
+// copy a continuous row into every N-th element of a row
+// kept scalar, as vector stores would also write the elements in between,
+// which may belong to another plane written by another thread
+template<typename T, int N>
+static inline void scatter_row_c(T *dst, const T *src, size_t width)
+{
+	for (size_t w = 0; w < width; ++w)
+	{
+		dst[w * N] = src[w];
+	}
+}
+
+////////
+// SSSE3 kernels
+// both directions are byte permutations between N vectors of interleaved data
+// and N vectors of planar data, each output vector is gathered from all the N
+// input vectors with PSHUFB, thus the same code handles any element size
+
+#ifdef ZIMGAPP_X86
+template<int N>
+struct ShuffleMasks
+{
+	alignas(16) uint8_t deinterleave[N][N][16]; // [plane][input vector][byte]
+	alignas(16) uint8_t interleave[N][N][16]; // [output vector][plane][byte]
+
+	explicit ShuffleMasks(size_t elem_size)
+	{
+		const int es = static_cast<int>(elem_size);
+		for (int c = 0; c < N; ++c)
+		{
+			for (int k = 0; k < N; ++k)
+			{
+				for (int j = 0; j < 16; ++j)
+				{
+					// byte j of plane c comes from byte idx of the interleaved data
+					const int idx = (j / es * N + c) * es + j % es;
+					this->deinterleave[c][k][j] = idx / 16 == k ? static_cast<uint8_t>(idx % 16) : 0x80;
+					// byte j of interleaved vector c comes from plane ch, byte pos
+					const int g = c * 16 + j;
+					const int ch = g % (N * es) / es;
+					const int pos = g / (N * es) * es + g % es;
+					this->interleave[c][k][j] = ch == k ? static_cast<uint8_t>(pos) : 0x80;
+				}
+			}
+		}
+	}
+
+	static const ShuffleMasks &get(size_t elem_size)
+	{
+		static const ShuffleMasks masks1(1), masks2(2), masks4(4);
+		return elem_size == 1 ? masks1 : elem_size == 2 ? masks2 : masks4;
+	}
+};
+
+// return the number of elements processed, the remaining ones are left to the scalar kernel
+template<typename T, int N>
+ZIMGAPP_TARGET_SSSE3
+static size_t deinterleave_row_ssse3(T *const *dst, const T *src, size_t width)
+{
+	const ShuffleMasks<N> &masks = ShuffleMasks<N>::get(sizeof(T));
+	const size_t step = 16 / sizeof(T);
+	const size_t upper = width / step * step;
+	__m128i mask[N][N];
+	for (int c = 0; c < N; ++c)
+	{
+		for (int k = 0; k < N; ++k)
+		{
+			mask[c][k] = _mm_load_si128(reinterpret_cast<const __m128i *>(masks.deinterleave[c][k]));
+		}
+	}
+
+	for (size_t w = 0; w < upper; w += step, src += step * N)
+	{
+		__m128i in[N];
+		for (int k = 0; k < N; ++k)
+		{
+			in[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src) + k);
+		}
+		for (int c = 0; c < N; ++c)
+		{
+			__m128i out = _mm_shuffle_epi8(in[0], mask[c][0]);
+			for (int k = 1; k < N; ++k)
+			{
+				out = _mm_or_si128(out, _mm_shuffle_epi8(in[k], mask[c][k]));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst[c] + w), out);
+		}
+	}
+	return upper;
+}
+
+// return the number of elements processed, the remaining ones are left to the scalar kernel
+template<typename T, int N>
+ZIMGAPP_TARGET_SSSE3
+static size_t interleave_row_ssse3(T *dst, const T *const *src, size_t width)
+{
+	const ShuffleMasks<N> &masks = ShuffleMasks<N>::get(sizeof(T));
+	const size_t step = 16 / sizeof(T);
+	const size_t upper = width / step * step;
+	__m128i mask[N][N];
+	for (int k = 0; k < N; ++k)
+	{
+		for (int c = 0; c < N; ++c)
+		{
+			mask[k][c] = _mm_load_si128(reinterpret_cast<const __m128i *>(masks.interleave[k][c]));
+		}
+	}
+
+	for (size_t w = 0; w < upper; w += step, dst += step * N)
+	{
+		__m128i in[N];
+		for (int c = 0; c < N; ++c)
+		{
+			in[c] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src[c] + w));
+		}
+		for (int k = 0; k < N; ++k)
+		{
+			__m128i out = _mm_shuffle_epi8(in[0], mask[k][0]);
+			for (int c = 1; c < N; ++c)
+			{
+				out = _mm_or_si128(out, _mm_shuffle_epi8(in[c], mask[k][c]));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst) + k, out);
+		}
+	}
+	return upper;
+}
+
+// return the number of elements processed, the remaining ones are left to the scalar kernel
+// gathering is the first plane of a deinterleave, without reading past the last element
+template<typename T, int N>
+ZIMGAPP_TARGET_SSSE3
+static size_t gather_row_ssse3(T *dst, const T *src, size_t width)
+{
+	const ShuffleMasks<N> &masks = ShuffleMasks<N>::get(sizeof(T));
+	const size_t step = 16 / sizeof(T);
+	// the last vector reads up to N - 1 elements after the last one, which may be out of the buffer
+	const size_t upper = width > 0 ? (width - 1) / step * step : 0;
+	__m128i mask[N];
+	for (int k = 0; k < N; ++k)
+	{
+		mask[k] = _mm_load_si128(reinterpret_cast<const __m128i *>(masks.deinterleave[0][k]));
+	}
+
+	for (size_t w = 0; w < upper; w += step, src += step * N)
+	{
+		__m128i out = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), mask[0]);
+		for (int k = 1; k < N; ++k)
+		{
+			out = _mm_or_si128(out, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src) + k), mask[k]));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + w), out);
+	}
+	return upper;
+}
+#endif
+
+////////
+// SSE2 kernels
+
+#ifdef ZIMGAPP_X86
+// copy rows with non-temporal stores, so that the target doesn't go through the cache,
+// while the source is prefetched ahead, the target rows are aligned with scalar heads
+ZIMGAPP_TARGET_SSE2
+static void stream_rows_sse2(uint8_t *dst, std::ptrdiff_t dst_stride,
+	const uint8_t *src, std::ptrdiff_t src_stride, size_t row_size, size_t height)
+{
+	const size_t prefetch = 512;
+	for (size_t h = 0; h < height; ++h, dst += dst_stride, src += src_stride)
+	{
+		const size_t misalign = reinterpret_cast<uintptr_t>(dst) % 16;
+		const size_t head = misalign ? std::min<size_t>(16 - misalign, row_size) : 0;
+		memcpy(dst, src, head);
+		size_t w = head;
+
+		for (; w + 64 <= row_size; w += 64)
+		{
+			_mm_prefetch(reinterpret_cast<const char *>(src + w + prefetch), _MM_HINT_NTA);
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + w));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + w + 16));
+			const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + w + 32));
+			const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + w + 48));
+			_mm_stream_si128(reinterpret_cast<__m128i *>(dst + w), a);
+			_mm_stream_si128(reinterpret_cast<__m128i *>(dst + w + 16), b);
+			_mm_stream_si128(reinterpret_cast<__m128i *>(dst + w + 32), c);
+			_mm_stream_si128(reinterpret_cast<__m128i *>(dst + w + 48), d);
+		}
+		for (; w + 16 <= row_size; w += 16)
+		{
+			_mm_stream_si128(reinterpret_cast<__m128i *>(dst + w),
+				_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + w)));
+		}
+		memcpy(dst + w, src + w, row_size - w);
+	}
+	// make the streamed data visible before the target is used by another thread
+	_mm_sfence();
+}
+#endif
+
+////////
+// dispatchers
+
+// copy rows with non-temporal stores when supported, return false otherwise
+// note that strides are based on BYTES
+static inline bool stream_rows(void *dst, std::ptrdiff_t dst_stride,
+	const void *src, std::ptrdiff_t src_stride, size_t row_size, size_t height)
+{
+#ifdef ZIMGAPP_X86
+	if (CpuFeatures::get().sse2)
+	{
+		stream_rows_sse2(static_cast<uint8_t *>(dst), dst_stride,
+			static_cast<const uint8_t *>(src), src_stride, row_size, height);
+		return true;
+	}
+#endif
+	return false;
+}
+
+// split one row of N interleaved channels into N planes
+// simd=false forces the scalar kernel
+template<typename T, int N>
+static inline void deinterleave_row(T *const *dst, const T *src, size_t width, bool simd = true)
+{
+	size_t done = 0;
+#ifdef ZIMGAPP_X86
+	if (simd && CpuFeatures::get().ssse3)
+	{
+		done = deinterleave_row_ssse3<T, N>(dst, src, width);
+	}
+#endif
+	if (done < width)
+	{
+		T *tail[N];
+		for (int c = 0; c < N; ++c) tail[c] = dst[c] + done;
+		deinterleave_row_c<T, N>(tail, src + done * N, width - done);
+	}
+}
+
+// merge one row of N planes into N interleaved channels
+// simd=false forces the scalar kernel
+template<typename T, int N>
+static inline void interleave_row(T *dst, const T *const *src, size_t width, bool simd = true)
+{
+	size_t done = 0;
+#ifdef ZIMGAPP_X86
+	if (simd && CpuFeatures::get().ssse3)
+	{
+		done = interleave_row_ssse3<T, N>(dst, src, width);
+	}
+#endif
+	if (done < width)
+	{
+		const T *tail[N];
+		for (int c = 0; c < N; ++c) tail[c] = src[c] + done;
+		interleave_row_c<T, N>(dst + done * N, tail, width - done);
+	}
+}
+
+// copy every N-th element of a row into a continuous row
+// simd=false forces the scalar kernel
+template<typename T, int N>
+static inline void gather_row(T *dst, const T *src, size_t width, bool simd = true)
+{
+	size_t done = 0;
+#ifdef ZIMGAPP_X86
+	if (simd && CpuFeatures::get().ssse3)
+	{
+		done = gather_row_ssse3<T, N>(dst, src, width);
+	}
+#endif
+	if (done < width)
+	{
+		gather_row_c<T, N>(dst + done, src + done * N, width - done);
+	}
+}
+
+// copy a 2D array of elements spaced by step elements into a 2D array of continuous rows
+// note that strides are based on BYTES, the step is dispatched at runtime
+// return false if the step is not supported
+template<typename T>
+static inline bool gather(T *dst, std::ptrdiff_t dst_stride,
+	const T *src, std::ptrdiff_t src_stride, std::ptrdiff_t step, size_t width, size_t height, bool simd = true)
+{
+	if (step < 2 || step > 4)
+	{
+		return false;
+	}
+	for (size_t h = 0; h < height; ++h)
+	{
+		T *dst_row = reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(dst) + h * dst_stride);
+		const T *src_row = reinterpret_cast<const T *>(reinterpret_cast<const uint8_t *>(src) + h * src_stride);
+
+		switch (step)
+		{
+		case 2: gather_row<T, 2>(dst_row, src_row, width, simd); break;
+		case 3: gather_row<T, 3>(dst_row, src_row, width, simd); break;
+		case 4: gather_row<T, 4>(dst_row, src_row, width, simd); break;
+		}
+	}
+	return true;
+}
+
+// copy a 2D array of continuous rows into a 2D array of elements spaced by step elements
+// note that strides are based on BYTES, the step is dispatched at runtime
+// return false if the step is not supported
+template<typename T>
+static inline bool scatter(T *dst, std::ptrdiff_t dst_stride,
+	const T *src, std::ptrdiff_t src_stride, std::ptrdiff_t step, size_t width, size_t height)
+{
+	if (step < 2 || step > 4)
+	{
+		return false;
+	}
+	for (size_t h = 0; h < height; ++h)
+	{
+		T *dst_row = reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(dst) + h * dst_stride);
+		const T *src_row = reinterpret_cast<const T *>(reinterpret_cast<const uint8_t *>(src) + h * src_stride);
+
+		switch (step)
+		{
+		case 2: scatter_row_c<T, 2>(dst_row, src_row, width); break;
+		case 3: scatter_row_c<T, 3>(dst_row, src_row, width); break;
+		case 4: scatter_row_c<T, 4>(dst_row, src_row, width); break;
+		}
+	}
+	return true;
+}
+
+// split a 2D array of interleaved channels into planes
+// note that strides are based on BYTES, the number of channels is dispatched at runtime
+// return false if the number of channels is not supported
+template<typename T>
+static inline bool deinterleave(T *const *dst, const std::ptrdiff_t *dst_stride,
+	const T *src, std::ptrdiff_t src_stride, int channels, size_t width, size_t height, bool simd = true)
+{
+	T *dst_row[4];
+	for (size_t h = 0; h < height; ++h)
+	{
+		for (int c = 0; c < channels; ++c)
+		{
+			dst_row[c] = reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(dst[c]) + h * dst_stride[c]);
+		}
+		const T *src_row = reinterpret_cast<const T *>(reinterpret_cast<const uint8_t *>(src) + h * src_stride);
+
+		switch (channels)
+		{
+		case 2: deinterleave_row<T, 2>(dst_row, src_row, width, simd); break;
+		case 3: deinterleave_row<T, 3>(dst_row, src_row, width, simd); break;
+		case 4: deinterleave_row<T, 4>(dst_row, src_row, width, simd); break;
+		default: return false;
+		}
+	}
+	return true;
+}
+
+// merge planes into a 2D array of interleaved channels
+// note that strides are based on BYTES, the number of channels is dispatched at runtime
+// return false if the number of channels is not supported
+template<typename T>
+static inline bool interleave(T *dst, std::ptrdiff_t dst_stride,
+	const T *const *src, const std::ptrdiff_t *src_stride, int channels, size_t width, size_t height, bool simd = true)
+{
+	const T *src_row[4];
+	for (size_t h = 0; h < height; ++h)
+	{
+		for (int c = 0; c < channels; ++c)
+		{
+			src_row[c] = reinterpret_cast<const T *>(reinterpret_cast<const uint8_t *>(src[c]) + h * src_stride[c]);
+		}
+		T *dst_row = reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(dst) + h * dst_stride);
+
+		switch (channels)
+		{
+		case 2: interleave_row<T, 2>(dst_row, src_row, width, simd); break;
+		case 3: interleave_row<T, 3>(dst_row, src_row, width, simd); break;
+		case 4: interleave_row<T, 4>(dst_row, src_row, width, simd); break;
+		default: return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,387 @@
+#pragma once
+
+#include "zimg_helper.hpp"
+#include "filter_cache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// thread-safe table of the fastest cpu type of each graph configuration on this CPU,
+// measured on a sample frame on the first request, and recorded in a text file shared by the processes
+// each line of the file holds the CPU model, the configuration key (hex), the cpu type and the measured time,
+// separated by tabs, new entries are appended and the last line of a key wins when loading
+// lines of other CPU models are ignored, so that a single file can be shared by a mixed fleet
+class CpuTuner
+{
+public:
+	typedef CpuTuner Tthis;
+	typedef ZFilter::Zformat Zformat;
+	typedef ZFilter::Zparams Zparams;
+	typedef ZFilter::Stage Stage;
+
+	struct Entry
+	{
+		std::string key; // configuration key (hex)
+		zimg_cpu_type_e cpu_type = ZIMG_CPU_AUTO;
+		double nanoseconds = 0; // fastest run of the chosen cpu type
+	};
+
+	explicit CpuTuner(const std::string &path = default_path())
+		: model(cpu_model()), path(path)
+	{}
+
+	// cpu type of the fastest graph converting src_format to dst_format with the params,
+	// of every candidate cpu type, the cpu type of the params is ignored
+	zimg_cpu_type_e tune(const Zformat &src_format, const Zformat &dst_format, const Zparams &params)
+	{
+		const std::string key = config_key(src_format, dst_format, params);
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->load();
+			auto found = this->table.find(key);
+			if (found != this->table.end()) return found->second.cpu_type;
+		}
+
+		// measure outside the lock, as it is much slower than a lookup
+		Entry entry;
+		entry.key = key;
+		entry.nanoseconds = -1;
+		for (zimg_cpu_type_e cpu_type : { ZIMG_CPU_AUTO, ZIMG_CPU_AUTO_64B, ZIMG_CPU_NONE })
+		{
+			Zparams candidate = params;
+			candidate.cpu_type = cpu_type;
+			const double nanoseconds = Probe(src_format, dst_format, candidate).measure(this->getRuns());
+			// the first candidates are kept unless another one is clearly faster, as the runs are noisy
+			if (entry.nanoseconds < 0 || nanoseconds < entry.nanoseconds * MARGIN)
+			{
+				entry.cpu_type = cpu_type;
+				entry.nanoseconds = nanoseconds;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto found = this->table.find(key);
+		if (found != this->table.end()) return found->second.cpu_type; // measured by another thread meanwhile
+		this->table[key] = entry;
+		this->save(entry);
+		return entry.cpu_type;
+	}
+
+	// set the cpu types of the graphs of the stages, the area averages are left unchanged
+	std::vector<Stage> tune(std::vector<Stage> stages)
+	{
+		for (Stage &stage : stages)
+		{
+			if (!stage.box) stage.params.cpu_type = this->tune(stage.src_format, stage.dst_format, stage.params);
+		}
+		return stages;
+	}
+
+	// custom resize parameters with the cpu type of their graph, see ZFilter::reduce_stages
+	ZResizeParams tune(ZResizeParams params,
+		unsigned src_width, unsigned src_height, unsigned dst_width, unsigned dst_height,
+		double roi_left = 0, double roi_top = 0, double roi_width = 0, double roi_height = 0)
+	{
+		Zformat src_format;
+		Zformat dst_format;
+		Zparams g_params;
+		ZFilter::resize_formats(src_format, dst_format, g_params, params,
+			src_width, src_height, dst_width, dst_height,
+			roi_left, roi_top, roi_width, roi_height);
+		const unsigned factor = ZFilter::reduce_factor(params.prereduce, src_format, dst_format);
+		const Stage stage = factor > 1 ? ZFilter::reduce_stages(src_format, dst_format, g_params, factor).back()
+			: Stage{ src_format, dst_format, g_params };
+		params.cpu_type = this->tune(stage.src_format, stage.dst_format, stage.params);
+		return params;
+	}
+
+	// change the file of the table, the entries are loaded from it on the next request
+	// an empty path keeps the table in memory only
+	void setPath(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->path = path;
+		this->table.clear();
+		this->loaded = false;
+	}
+
+	std::string getPath() const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->path;
+	}
+
+	// number of timed runs of each candidate, after a first untimed one
+	void setRuns(unsigned runs)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->runs = std::max(1U, runs);
+	}
+
+	unsigned getRuns() const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->runs;
+	}
+
+	const std::string &getModel() const { return this->model; }
+
+	// entries of this CPU model
+	std::vector<Entry> getEntries()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->load();
+		std::vector<Entry> result;
+		for (const auto &item : this->table) result.push_back(item.second);
+		return result;
+	}
+
+	// forget the measurements, the file is emptied of the lines of this CPU model
+	// the other lines are written to a temporary file replacing it, so that the file is never left truncated
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->table.clear();
+		this->loaded = true;
+		if (this->path.empty()) return;
+		std::vector<std::string> lines;
+		{
+			std::ifstream file(this->path);
+			std::string line;
+			while (std::getline(file, line))
+			{
+				if (line.compare(0, this->model.size() + 1, this->model + '\t') != 0) lines.push_back(line);
+			}
+		}
+		const std::string temp = this->path + ".tmp";
+		{
+			std::ofstream file(temp, std::ios::trunc);
+			for (const std::string &line : lines) file << line << '\n';
+			if (!file.flush())
+			{
+				file.close();
+				std::remove(temp.c_str());
+				throw std::runtime_error("Failed to write " + temp);
+			}
+		}
+#ifdef _WIN32
+		// rename doesn't replace an existing file on Windows
+		std::remove(this->path.c_str());
+#endif
+		if (std::rename(temp.c_str(), this->path.c_str()) != 0)
+		{
+			std::remove(temp.c_str());
+			throw std::runtime_error("Failed to replace " + this->path);
+		}
+	}
+
+	// hold the mutex across a fork, so that the child doesn't inherit it locked by another thread
+	// unlock() should be called in both the parent and the child
+	void lock() { this->mutex.lock(); }
+	void unlock() { this->mutex.unlock(); }
+
+	// process-wide instance, its file is $ZIMG_TUNE_FILE, or zimg_cpu_tune.tsv in the user cache directory
+	static Tthis &global()
+	{
+		static Tthis tuner;
+		return tuner;
+	}
+
+	// brand string of the CPU, with the number of logical processors,
+	// as machines of the same model may have other cache sizes and clocks
+	static std::string cpu_model()
+	{
+		std::string brand;
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+		unsigned regs[12] = {};
+		for (unsigned k = 0; k < 3; ++k)
+		{
+#if defined(_MSC_VER)
+			__cpuid(reinterpret_cast<int *>(regs + 4 * k), 0x80000002 + k);
+#else
+			__get_cpuid(0x80000002 + k, regs + 4 * k, regs + 4 * k + 1, regs + 4 * k + 2, regs + 4 * k + 3);
+#endif
+		}
+		brand.assign(reinterpret_cast<const char *>(regs), strnlen(reinterpret_cast<const char *>(regs), sizeof(regs)));
+#else
+		std::ifstream cpuinfo("/proc/cpuinfo");
+		std::string line;
+		while (brand.empty() && std::getline(cpuinfo, line))
+		{
+			if (line.compare(0, 10, "model name") == 0 || line.compare(0, 9, "Processor") == 0)
+			{
+				brand = line.substr(line.find(':') + 1);
+			}
+		}
+#endif
+		// the fields of the file are separated by tabs
+		std::string model;
+		for (char c : brand)
+		{
+			if (c == '\t') c = ' ';
+			if (c != ' ' || (!model.empty() && model.back() != ' ')) model += c;
+		}
+		while (!model.empty() && model.back() == ' ') model.pop_back();
+		if (model.empty()) model = "unknown";
+		return model + " x" + std::to_string(std::thread::hardware_concurrency());
+	}
+
+	static std::string default_path()
+	{
+		const char *path = std::getenv("ZIMG_TUNE_FILE");
+		if (path) return path;
+#ifdef _WIN32
+		const char *dir = std::getenv("LOCALAPPDATA");
+		return dir ? std::string(dir) + "\\zimg_cpu_tune.tsv" : std::string();
+#else
+		const char *dir = std::getenv("XDG_CACHE_HOME");
+		if (dir && *dir) return std::string(dir) + "/zimg_cpu_tune.tsv";
+		dir = std::getenv("HOME");
+		return dir ? std::string(dir) + "/.cache/zimg_cpu_tune.tsv" : std::string();
+#endif
+	}
+
+	// key of the configuration, every field but the cpu type
+	static std::string config_key(const Zformat &src_format, const Zformat &dst_format, Zparams params)
+	{
+		params.cpu_type = ZIMG_CPU_AUTO;
+		const std::string key = FilterCache<ZFilter>::make_key(src_format, dst_format, params);
+		static const char digits[] = "0123456789abcdef";
+		std::string result;
+		for (unsigned char c : key)
+		{
+			result += digits[c >> 4];
+			result += digits[c & 15];
+		}
+		return result;
+	}
+
+protected:
+	// a candidate should be this much faster than the previous ones to be chosen
+	static constexpr double MARGIN = 0.97;
+
+	// graph of a candidate, processing a sample frame
+	class Probe
+		: public ZFilter
+	{
+	public:
+		Probe(const Zformat &src_format, const Zformat &dst_format, const Zparams &params)
+			: ZFilter(src_format, dst_format, params)
+		{}
+
+		// nanoseconds of the fastest of the runs, after a first one touching the memory
+		double measure(unsigned runs)
+		{
+			Zbuffer src;
+			Zbuffer dst;
+			const PlaneLayout &layout = this->layout; // of the cpu type of the candidate
+			TempPtr src_buf(aligned_malloc(fill_planes(src, this->src_format, nullptr, layout), layout.alignment),
+				AlignedDeleter());
+			TempPtr dst_buf(aligned_malloc(fill_planes(dst, this->dst_format, nullptr, layout), layout.alignment),
+				AlignedDeleter());
+			sample(src_buf.get(), fill_planes(src, this->src_format, src_buf.get(), layout), this->src_format);
+			fill_planes(dst, this->dst_format, dst_buf.get(), layout);
+
+			double best = -1;
+			for (unsigned k = 0; k <= runs; ++k)
+			{
+				const auto start = std::chrono::steady_clock::now();
+				this->process(src.as_const(), dst);
+				const double elapsed = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start).count());
+				if (k > 0 && (best < 0 || elapsed < best)) best = elapsed;
+			}
+			return best;
+		}
+
+	protected:
+		// gradient of valid values of the pixel type, without denormals
+		static void sample(void *data, size_t size, const Zformat &format)
+		{
+			const size_t count = size / pixel_size(format.pixel_type);
+			const unsigned mask = (1U << std::min(format.depth, 16U)) - 1;
+			for (size_t i = 0; i < count; ++i)
+			{
+				const unsigned value = static_cast<unsigned>(i * 37 % 251);
+				switch (format.pixel_type)
+				{
+				case ZIMG_PIXEL_BYTE:
+					static_cast<uint8_t *>(data)[i] = static_cast<uint8_t>(value & mask);
+					break;
+				case ZIMG_PIXEL_WORD:
+					static_cast<uint16_t *>(data)[i] = static_cast<uint16_t>(value * 257 & mask);
+					break;
+				case ZIMG_PIXEL_HALF:
+					static_cast<uint16_t *>(data)[i] = static_cast<uint16_t>(0x3000 + value); // [0.125, 0.25)
+					break;
+				default:
+					static_cast<float *>(data)[i] = value / 250.0f;
+					break;
+				}
+			}
+		}
+	};
+
+	const std::string model;
+	mutable std::mutex mutex;
+	std::string path;
+	unsigned runs = 3;
+	bool loaded = false;
+	std::unordered_map<std::string, Entry> table; // entries of this CPU model, by key
+
+	CpuTuner(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+
+	// read the entries of the file once, the mutex should be held
+	// lines with another cpu type than the candidates are ignored, as the file may be edited by hand
+	void load()
+	{
+		if (this->loaded) return;
+		this->loaded = true;
+		if (this->path.empty()) return;
+		std::ifstream file(this->path);
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::istringstream fields(line);
+			std::string model;
+			Entry entry;
+			int cpu_type = 0;
+			if (std::getline(fields, model, '\t') && model == this->model
+				&& std::getline(fields, entry.key, '\t') && fields >> cpu_type >> entry.nanoseconds
+				&& (cpu_type == ZIMG_CPU_NONE || cpu_type == ZIMG_CPU_AUTO || cpu_type == ZIMG_CPU_AUTO_64B))
+			{
+				entry.cpu_type = static_cast<zimg_cpu_type_e>(cpu_type);
+				this->table[entry.key] = entry;
+			}
+		}
+	}
+
+	// append an entry to the file, the mutex should be held
+	// the table still works in memory when the file can't be written
+	void save(const Entry &entry)
+	{
+		if (this->path.empty()) return;
+		std::ofstream file(this->path, std::ios::app);
+		if (file)
+		{
+			file << this->model << '\t' << entry.key << '\t' << static_cast<int>(entry.cpu_type)
+				<< '\t' << static_cast<int64_t>(entry.nanoseconds) << '\n';
+		}
+	}
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "zimg_helper.hpp"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// thread-safe LRU cache of filters, keyed by the full zimage formats and zfilter graph params
+// cached filters are built as concurrent instances, thus they can be shared by multiple threads
+// Tfilter should be constructible from (src_format, dst_format, params, concurrent)
+template<typename Tfilter>
+class FilterCache
+{
+public:
+	typedef FilterCache<Tfilter> Tthis;
+	typedef std::shared_ptr<Tfilter> Tptr;
+	typedef ZFilter::Zformat Zformat;
+	typedef ZFilter::Zparams Zparams;
+	typedef std::string Tkey;
+
+	struct Stats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t size = 0;
+		size_t capacity = 0;
+	};
+
+	explicit FilterCache(size_t capacity = 32)
+		: capacity(capacity)
+	{}
+
+	// get the filter matching the parameters, build and insert it on miss
+	Tptr get(const Zformat &src_format, const Zformat &dst_format, const Zparams &params)
+	{
+		const Tkey key = make_key(src_format, dst_format, params);
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			auto found = this->index.find(key);
+			if (found != this->index.end())
+			{
+				++this->stats.hits;
+				this->entries.splice(this->entries.begin(), this->entries, found->second);
+				return found->second->second;
+			}
+			++this->stats.misses;
+		}
+
+		// build outside the lock, as it is much slower than a lookup
+		Tptr filter = std::make_shared<Tfilter>(src_format, dst_format, params, true);
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto found = this->index.find(key);
+		if (found != this->index.end()) // inserted by another thread in the meantime
+		{
+			this->entries.splice(this->entries.begin(), this->entries, found->second);
+			return found->second->second;
+		}
+		if (this->capacity > 0)
+		{
+			this->entries.emplace_front(key, filter);
+			this->index[key] = this->entries.begin();
+			this->shrink(this->capacity);
+		}
+		return filter;
+	}
+
+	// get the filter matching the custom resize parameters
+	// cached filters are single graphs, thus prereduce is not supported
+	Tptr get(const ZResizeParams &params,
+		unsigned src_width, unsigned src_height, unsigned dst_width, unsigned dst_height,
+		double roi_left = 0, double roi_top = 0, double roi_width = 0, double roi_height = 0)
+	{
+		if (params.prereduce > 1)
+		{
+			throw std::runtime_error("Cached resizers don't support prereduce");
+		}
+		Zformat src_format;
+		Zformat dst_format;
+		Zparams g_params;
+		ZFilter::resize_formats(src_format, dst_format, g_params, params,
+			src_width, src_height, dst_width, dst_height,
+			roi_left, roi_top, roi_width, roi_height);
+		return this->get(src_format, dst_format, g_params);
+	}
+
+	// set the maximum number of cached filters, the least recently used ones are evicted
+	void setCapacity(size_t capacity)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->capacity = capacity;
+		this->shrink(capacity);
+	}
+
+	size_t getCapacity() const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->capacity;
+	}
+
+	Stats getStats() const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		Stats result = this->stats;
+		result.size = this->entries.size();
+		result.capacity = this->capacity;
+		return result;
+	}
+
+	void resetStats()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stats = Stats();
+	}
+
+	// remove all the cached filters, filters still referenced elsewhere stay valid
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->index.clear();
+		this->entries.clear();
+	}
+
+	// hold the mutex across a fork, so that the child doesn't inherit it locked by another thread
+	// unlock() should be called in both the parent and the child
+	void lock() { this->mutex.lock(); }
+	void unlock() { this->mutex.unlock(); }
+
+	// process-wide instance
+	static Tthis &global()
+	{
+		static Tthis cache;
+		return cache;
+	}
+
+	// serialize every field of the parameters, as padding bytes of the structs are undefined
+	static Tkey make_key(const Zformat &src_format, const Zformat &dst_format, const Zparams &params)
+	{
+		Tkey key;
+		append_format(key, src_format);
+		append_format(key, dst_format);
+		append(key, params.resample_filter);
+		append(key, params.filter_param_a);
+		append(key, params.filter_param_b);
+		append(key, params.resample_filter_uv);
+		append(key, params.filter_param_a_uv);
+		append(key, params.filter_param_b_uv);
+		append(key, params.dither_type);
+		append(key, params.cpu_type);
+		append(key, params.nominal_peak_luminance);
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+		append(key, params.allow_approximate_gamma);
+#endif
+		return key;
+	}
+
+protected:
+	typedef std::list<std::pair<Tkey, Tptr>> Tlist;
+
+	mutable std::mutex mutex;
+	size_t capacity;
+	Tlist entries; // most recently used first
+	std::unordered_map<Tkey, typename Tlist::iterator> index;
+	Stats stats;
+
+	FilterCache(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+
+	// evict the least recently used entries, the mutex should be held
+	void shrink(size_t capacity)
+	{
+		while (this->entries.size() > capacity)
+		{
+			this->index.erase(this->entries.back().first);
+			this->entries.pop_back();
+			++this->stats.evictions;
+		}
+	}
+
+	template<typename T>
+	static void append(Tkey &key, const T &value)
+	{
+		key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+	}
+
+	static void append_format(Tkey &key, const Zformat &format)
+	{
+		append(key, format.width);
+		append(key, format.height);
+		append(key, format.pixel_type);
+		append(key, format.subsample_w);
+		append(key, format.subsample_h);
+		append(key, format.color_family);
+		append(key, format.matrix_coefficients);
+		append(key, format.transfer_characteristics);
+		append(key, format.color_primaries);
+		append(key, format.depth);
+		append(key, format.pixel_range);
+		append(key, format.field_parity);
+		append(key, format.chroma_location);
+		append(key, format.active_region.left);
+		append(key, format.active_region.top);
+		append(key, format.active_region.width);
+		append(key, format.active_region.height);
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+		append(key, format.alpha);
+#endif
+	}
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// cumulative counters of the calls on a filter, which can be updated from multiple threads
+// disabled by default, then each update point only costs a relaxed atomic load
+class FilterStats
+{
+public:
+	typedef FilterStats Tthis;
+	typedef std::chrono::steady_clock Tclock;
+
+	// phases of a call, timed separately
+	enum Phase
+	{
+		PHASE_PREPARE = 0, // checking the arguments and allocating the output
+		PHASE_ALLOC, // getting the temp planes from the scratch arena
+		PHASE_COPY_IN, // copying the source into the temp planes
+		PHASE_PROCESS, // running the filter graphs (including the row callbacks when streaming)
+		PHASE_COPY_OUT, // copying the temp planes into the target
+		NUM_PHASES
+	};
+
+	// ways a part of an image is passed between the caller's memory and zimg
+	enum Path
+	{
+		PATH_ZERO_COPY = 0, // used in place
+		PATH_BITBLT, // continuous rows copied with memcpy
+		PATH_INTERLEAVE, // channels (de)interleaved
+		PATH_STRIDED, // elements spaced by 2 to 4 elements copied with a fixed step
+		PATH_ELEMENTWISE, // strided elements copied one by one
+		NUM_PATHS
+	};
+
+	struct Snapshot
+	{
+		uint64_t calls = 0;
+		uint64_t images = 0;
+		uint64_t bytes_in = 0;
+		uint64_t bytes_out = 0;
+		std::array<uint64_t, NUM_PHASES> nanoseconds = {};
+		std::array<uint64_t, NUM_PATHS> paths_in = {};
+		std::array<uint64_t, NUM_PATHS> paths_out = {};
+	};
+
+	// measure the time spent in a phase until the end of the scope
+	class Timer
+	{
+	public:
+		Timer(FilterStats &stats, Phase phase)
+			: stats(stats.isEnabled() ? &stats : nullptr), phase(phase)
+		{
+			if (this->stats) this->start = Tclock::now();
+		}
+
+		~Timer()
+		{
+			this->stop();
+		}
+
+		// end the measure before the end of the scope
+		void stop()
+		{
+			if (this->stats)
+			{
+				const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Tclock::now() - this->start);
+				this->stats->nanoseconds[this->phase].fetch_add(elapsed.count(), std::memory_order_relaxed);
+				this->stats = nullptr;
+			}
+		}
+
+	protected:
+		FilterStats *stats;
+		Phase phase;
+		Tclock::time_point start;
+
+		Timer(const Timer &other) = delete;
+		Timer &operator=(const Timer &other) = delete;
+	};
+
+	FilterStats()
+		: enabled(false)
+	{
+		this->reset();
+	}
+
+	bool isEnabled() const { return this->enabled.load(std::memory_order_relaxed); }
+	void setEnabled(bool enabled) { this->enabled.store(enabled, std::memory_order_relaxed); }
+
+	// count a call processing the specified number of images and bytes
+	void addCall(uint64_t images, uint64_t bytes_in, uint64_t bytes_out)
+	{
+		if (!this->isEnabled()) return;
+		this->calls.fetch_add(1, std::memory_order_relaxed);
+		this->images.fetch_add(images, std::memory_order_relaxed);
+		this->bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+		this->bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+	}
+
+	// count the path taken by a part of the source (input=true) or the target
+	void addPath(bool input, Path path)
+	{
+		if (!this->isEnabled()) return;
+		(input ? this->paths_in : this->paths_out)[path].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	Snapshot getSnapshot() const
+	{
+		Snapshot result;
+		result.calls = this->calls.load(std::memory_order_relaxed);
+		result.images = this->images.load(std::memory_order_relaxed);
+		result.bytes_in = this->bytes_in.load(std::memory_order_relaxed);
+		result.bytes_out = this->bytes_out.load(std::memory_order_relaxed);
+		for (int i = 0; i < NUM_PHASES; ++i)
+		{
+			result.nanoseconds[i] = this->nanoseconds[i].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < NUM_PATHS; ++i)
+		{
+			result.paths_in[i] = this->paths_in[i].load(std::memory_order_relaxed);
+			result.paths_out[i] = this->paths_out[i].load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+	// reset the counters, the calls in progress may still be partially counted
+	void reset()
+	{
+		this->calls.store(0, std::memory_order_relaxed);
+		this->images.store(0, std::memory_order_relaxed);
+		this->bytes_in.store(0, std::memory_order_relaxed);
+		this->bytes_out.store(0, std::memory_order_relaxed);
+		for (auto &value : this->nanoseconds) value.store(0, std::memory_order_relaxed);
+		for (auto &value : this->paths_in) value.store(0, std::memory_order_relaxed);
+		for (auto &value : this->paths_out) value.store(0, std::memory_order_relaxed);
+	}
+
+	static const char *phase_name(int phase)
+	{
+		static const char *const names[NUM_PHASES] = { "prepare", "alloc", "copy_in", "process", "copy_out" };
+		return names[phase];
+	}
+
+	static const char *path_name(int path)
+	{
+		static const char *const names[NUM_PATHS] = { "zero_copy", "bitblt", "interleave", "strided", "elementwise" };
+		return names[path];
+	}
+
+protected:
+	std::atomic<bool> enabled;
+	std::atomic<uint64_t> calls;
+	std::atomic<uint64_t> images;
+	std::atomic<uint64_t> bytes_in;
+	std::atomic<uint64_t> bytes_out;
+	std::array<std::atomic<uint64_t>, NUM_PHASES> nanoseconds;
+	std::array<std::atomic<uint64_t>, NUM_PATHS> paths_in;
+	std::array<std::atomic<uint64_t>, NUM_PATHS> paths_out;
+
+	FilterStats(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+};
@@ -0,0 +1,576 @@
+#pragma once
+
+#include "zimg_helper.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// memory mapping of a whole file, read-only, or read-write with a length which can grow
+// *** not thread-safe, resizing invalidates the previous pointers ***
+class MappedFile
+{
+public:
+	typedef MappedFile Tthis;
+
+	// open an existing file for reading, or create (truncate) a file for writing
+	MappedFile(const std::string &path, bool writable)
+		: writable(writable)
+	{
+#ifdef _WIN32
+		this->file = CreateFileA(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+			FILE_SHARE_READ, nullptr, writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER size = {};
+		if (this->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(this->file, &size))
+		{
+			this->close();
+			throw std::runtime_error("Failed to open " + path);
+		}
+		this->length = static_cast<size_t>(size.QuadPart);
+#else
+		this->fd = ::open(path.c_str(), writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+		struct stat info;
+		if (this->fd < 0 || fstat(this->fd, &info) != 0)
+		{
+			this->close();
+			throw std::runtime_error("Failed to open " + path);
+		}
+		this->length = static_cast<size_t>(info.st_size);
+#endif
+		// the destructor doesn't run when the constructor throws
+		try
+		{
+			this->map();
+		}
+		catch (...)
+		{
+			this->close();
+			throw;
+		}
+	}
+
+	~MappedFile()
+	{
+		this->close();
+	}
+
+	uint8_t *data() const { return this->ptr; }
+	size_t size() const { return this->length; }
+	bool isWritable() const { return this->writable; }
+
+	// change the length of a writable file, the content is kept up to the smaller length
+	void resize(size_t size)
+	{
+		if (!this->writable)
+		{
+			throw std::runtime_error("Read-only files can't be resized");
+		}
+		this->unmap();
+#ifdef _WIN32
+		LARGE_INTEGER offset = {};
+		offset.QuadPart = static_cast<LONGLONG>(size);
+		const bool done = SetFilePointerEx(this->file, offset, nullptr, FILE_BEGIN) && SetEndOfFile(this->file);
+#else
+		const bool done = ftruncate(this->fd, static_cast<off_t>(size)) == 0;
+#endif
+		if (!done)
+		{
+			throw std::runtime_error("Failed to resize the mapped file");
+		}
+		this->length = size;
+		this->map();
+	}
+
+	// hint that the range will be read soon (willneed=true), or is no longer needed
+	// the range is extended to whole pages, it only affects the performance
+	void advise(size_t offset, size_t size, bool willneed) const
+	{
+#ifndef _WIN32
+		const size_t page = page_size();
+		const size_t begin = offset / page * page;
+		const size_t end = std::min(this->length, offset + size);
+		if (this->ptr && begin < end)
+		{
+			madvise(this->ptr + begin, end - begin, willneed ? MADV_WILLNEED : MADV_DONTNEED);
+		}
+#else
+		(void)offset;
+		(void)size;
+		(void)willneed;
+#endif
+	}
+
+	// read one byte of every page of the range, so that the page faults happen in the calling thread
+	void touch(size_t offset, size_t size) const
+	{
+		const size_t page = page_size();
+		const size_t end = std::min(this->length, offset + size);
+		unsigned sum = 0;
+		for (size_t k = offset / page * page; k < end; k += page)
+		{
+			sum += static_cast<volatile const uint8_t *>(this->ptr)[k];
+		}
+		(void)sum;
+	}
+
+	// unmap and close the file, the file is kept with its current length
+	void close()
+	{
+		this->unmap();
+#ifdef _WIN32
+		if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+		this->file = INVALID_HANDLE_VALUE;
+#else
+		if (this->fd >= 0) ::close(this->fd);
+		this->fd = -1;
+#endif
+	}
+
+	static size_t page_size()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+#else
+		return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+protected:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+	uint8_t *ptr = nullptr;
+	size_t length = 0;
+	bool writable;
+
+	MappedFile(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+
+	// empty files can't be mapped, they keep a null pointer
+	void map()
+	{
+		if (!this->length)
+		{
+			return;
+		}
+#ifdef _WIN32
+		this->mapping = CreateFileMappingA(this->file, nullptr, this->writable ? PAGE_READWRITE : PAGE_READONLY,
+			0, 0, nullptr);
+		this->ptr = this->mapping ? static_cast<uint8_t *>(MapViewOfFile(this->mapping,
+			this->writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0)) : nullptr;
+		if (!this->ptr)
+		{
+			throw std::runtime_error("Failed to map the file");
+		}
+#else
+		void *addr = mmap(nullptr, this->length, this->writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, this->fd, 0);
+		if (addr == MAP_FAILED)
+		{
+			throw std::runtime_error("Failed to map the file");
+		}
+		this->ptr = static_cast<uint8_t *>(addr);
+		if (!this->writable)
+		{
+			madvise(addr, this->length, MADV_SEQUENTIAL);
+		}
+#endif
+	}
+
+	void unmap()
+	{
+#ifdef _WIN32
+		if (this->ptr) UnmapViewOfFile(this->ptr);
+		if (this->mapping) CloseHandle(this->mapping);
+		this->mapping = nullptr;
+#else
+		if (this->ptr) munmap(this->ptr, this->length);
+#endif
+		this->ptr = nullptr;
+	}
+};
+
+// size in bytes of a frame of the format with the planes one after another
+// the chroma dimensions are rounded up, as in y4m files of odd dimensions
+static inline size_t frame_size(const zimgxx::zimage_format &format)
+{
+	size_t size = 0;
+	for (int p = 0; p < plane_count(format); ++p)
+	{
+		const size_t width = is_chroma(format, p) ? (format.width + (1U << format.subsample_w) - 1) >> format.subsample_w
+			: format.width;
+		const size_t height = is_chroma(format, p) ? (format.height + (1U << format.subsample_h) - 1) >> format.subsample_h
+			: format.height;
+		size += width * height;
+	}
+	return size * pixel_size(format.pixel_type);
+}
+
+// whether frames of both formats have the same layout in memory
+static inline bool same_geometry(const zimgxx::zimage_format &a, const zimgxx::zimage_format &b)
+{
+	return a.width == b.width && a.height == b.height && a.pixel_type == b.pixel_type
+		&& a.subsample_w == b.subsample_w && a.subsample_h == b.subsample_h && plane_count(a) == plane_count(b);
+}
+
+// YUV4MPEG2 (y4m) streams, a text header line of space separated tags followed by frames,
+// each made of a FRAME line and the planes one after another
+struct Y4m
+{
+	typedef zimgxx::zimage_format Zformat;
+
+	static const char *magic() { return "YUV4MPEG2"; }
+
+	// fill the geometry of the format from the tags of a header line,
+	// the tags other than the dimensions and the chroma format are returned as they are
+	static std::string parse_header(Zformat &format, const std::string &header)
+	{
+		std::string params;
+		std::string chroma = "420jpeg";
+		format.width = 0;
+		format.height = 0;
+		size_t pos = std::strlen(magic());
+		while (pos < header.size())
+		{
+			const size_t end = std::min(header.find(' ', pos), header.size());
+			const std::string tag = header.substr(pos, end - pos);
+			pos = end + 1;
+			if (tag.empty()) continue;
+			switch (tag[0])
+			{
+			case 'W': format.width = static_cast<unsigned>(std::strtoul(tag.c_str() + 1, nullptr, 10)); break;
+			case 'H': format.height = static_cast<unsigned>(std::strtoul(tag.c_str() + 1, nullptr, 10)); break;
+			case 'C': chroma = tag.substr(1); break;
+			default: params += (params.empty() ? "" : " ") + tag; break;
+			}
+		}
+		if (!format.width || !format.height)
+		{
+			throw std::runtime_error("y4m header must have the W and H tags");
+		}
+
+		// 420jpeg, 420mpeg2, 420paldv, 420, 422, 444, 411 and mono, followed by p<depth> (or <depth> for mono)
+		const bool mono = chroma.compare(0, 4, "mono") == 0;
+		const std::string layout = mono ? "mono" : chroma.substr(0, 3);
+		std::string suffix = chroma.substr(layout.size());
+		format.color_family = mono ? ZIMG_COLOR_GREY : ZIMG_COLOR_YUV;
+		format.subsample_w = layout == "420" || layout == "422" ? 1 : layout == "411" ? 2 : 0;
+		format.subsample_h = layout == "420" ? 1 : 0;
+		if (!mono && layout != "420" && layout != "422" && layout != "444" && layout != "411")
+		{
+			throw std::runtime_error("Unsupported y4m chroma format " + chroma);
+		}
+		format.chroma_location = suffix == "mpeg2" ? ZIMG_CHROMA_LEFT : suffix == "paldv" ? ZIMG_CHROMA_TOP_LEFT
+			: ZIMG_CHROMA_CENTER;
+		if (suffix == "jpeg" || suffix == "mpeg2" || suffix == "paldv")
+		{
+			suffix.clear();
+		}
+		if (!suffix.empty() && suffix[0] == 'p')
+		{
+			suffix.erase(0, 1);
+		}
+		format.depth = suffix.empty() ? 8 : static_cast<unsigned>(std::strtoul(suffix.c_str(), nullptr, 10));
+		if (format.depth < 8 || format.depth > 16)
+		{
+			throw std::runtime_error("Unsupported y4m chroma format " + chroma);
+		}
+		format.pixel_type = format.depth > 8 ? ZIMG_PIXEL_WORD : ZIMG_PIXEL_BYTE;
+		return params;
+	}
+
+	// header line of a stream of frames of the format, with the other tags as given
+	static std::string make_header(const Zformat &format, const std::string &params)
+	{
+		std::string chroma;
+		if (format.color_family == ZIMG_COLOR_GREY)
+		{
+			chroma = "mono";
+		}
+		else if (format.subsample_w == 1 && format.subsample_h == 1)
+		{
+			chroma = format.depth > 8 ? "420" : format.chroma_location == ZIMG_CHROMA_LEFT ? "420mpeg2"
+				: format.chroma_location == ZIMG_CHROMA_TOP_LEFT ? "420paldv" : "420jpeg";
+		}
+		else if (format.subsample_w == 1 && format.subsample_h == 0)
+		{
+			chroma = "422";
+		}
+		else if (format.subsample_w == 2 && format.subsample_h == 0)
+		{
+			chroma = "411";
+		}
+		else if (format.subsample_w == 0 && format.subsample_h == 0)
+		{
+			chroma = "444";
+		}
+		if (chroma.empty() || format.pixel_type != (format.depth > 8 ? ZIMG_PIXEL_WORD : ZIMG_PIXEL_BYTE)
+			|| plane_count(format) != (format.color_family == ZIMG_COLOR_GREY ? 1 : 3))
+		{
+			throw std::runtime_error("Format can't be stored in a y4m stream");
+		}
+		if (format.depth > 8)
+		{
+			chroma += (format.color_family == ZIMG_COLOR_GREY ? "" : "p") + std::to_string(format.depth);
+		}
+		return std::string(magic()) + " W" + std::to_string(format.width) + " H" + std::to_string(format.height)
+			+ " C" + chroma + (params.empty() ? "" : " " + params) + "\n";
+	}
+};
+
+// sequence of frames read in place from a memory-mapped file,
+// either raw frames with the planes one after another (I420 layout), or a y4m stream
+// a background thread reads ahead the frames following the last requested one,
+// so that the I/O overlaps with the processing of the current frame
+class FrameReader
+{
+public:
+	typedef FrameReader Tthis;
+	typedef zimgxx::zimage_format Zformat;
+
+	// a y4m stream is recognized by its header, which gives the geometry of the frames,
+	// format is then optional and only checked, otherwise it describes the raw frames
+	// readahead is the number of frames read ahead, 0 disables the background thread
+	FrameReader(const std::string &path, const Zformat *format, unsigned readahead = 2)
+		: file(path, false), readahead(readahead)
+	{
+		const uint8_t *data = this->file.data();
+		const size_t size = this->file.size();
+		const size_t magic_size = std::strlen(Y4m::magic());
+		this->y4m = size > magic_size && std::memcmp(data, Y4m::magic(), magic_size) == 0;
+
+		if (this->y4m) // frame offsets after the FRAME line of each one, which may have its own tags
+		{
+			const uint8_t *eol = static_cast<const uint8_t *>(std::memchr(data, '\n', size));
+			if (!eol)
+			{
+				throw std::runtime_error("Incomplete y4m header");
+			}
+			this->params = Y4m::parse_header(this->format, std::string(data, eol));
+			if (format && !same_geometry(*format, this->format))
+			{
+				throw std::runtime_error("Format doesn't match the frames of the y4m stream");
+			}
+			this->bytes = frame_size(this->format);
+			for (size_t pos = eol - data + 1; pos + 5 < size; )
+			{
+				eol = static_cast<const uint8_t *>(std::memchr(data + pos, '\n', size - pos));
+				if (std::memcmp(data + pos, "FRAME", 5) != 0 || !eol || size - (eol - data + 1) < this->bytes)
+				{
+					break; // truncated stream, the last complete frame ends the sequence
+				}
+				this->offsets.push_back(eol - data + 1);
+				pos = this->offsets.back() + this->bytes;
+			}
+		}
+		else
+		{
+			if (!format)
+			{
+				throw std::runtime_error("Raw frames require a format");
+			}
+			this->format = *format;
+			this->bytes = frame_size(this->format);
+			for (size_t pos = 0; this->bytes && pos + this->bytes <= size; pos += this->bytes)
+			{
+				this->offsets.push_back(pos);
+			}
+		}
+
+		if (this->readahead && !this->offsets.empty())
+		{
+			this->worker = std::thread(&Tthis::prefetch_loop, this);
+		}
+	}
+
+	~FrameReader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stop = true;
+		}
+		this->cond.notify_one();
+		if (this->worker.joinable()) this->worker.join();
+	}
+
+	const Zformat &getFormat() const { return this->format; }
+	const std::string &getParams() const { return this->params; }
+	bool isY4m() const { return this->y4m; }
+	size_t getCount() const { return this->offsets.size(); }
+	size_t getFrameSize() const { return this->bytes; }
+
+	// data of the frame k, valid as long as the reader, the following frames are read ahead
+	// can be called from any thread
+	const uint8_t *frame(size_t k)
+	{
+		if (k >= this->offsets.size())
+		{
+			throw std::out_of_range("Frame index out of range");
+		}
+		if (this->readahead)
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->target = std::min(k + this->readahead, this->offsets.size() - 1);
+				// a seek outside of the read-ahead window restarts from k, frames already read ahead are kept
+				if (k >= this->next + this->readahead || k + this->readahead < this->next)
+				{
+					this->next = k + 1;
+				}
+				else
+				{
+					this->next = std::max(this->next, k + 1);
+				}
+			}
+			this->cond.notify_one();
+		}
+		return this->file.data() + this->offsets[k];
+	}
+
+protected:
+	MappedFile file;
+	Zformat format;
+	std::string params; // y4m header tags other than the geometry
+	bool y4m;
+	size_t bytes; // size of a frame
+	std::vector<size_t> offsets;
+	unsigned readahead;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable cond;
+	size_t next = 0; // next frame to read ahead
+	size_t target = 0; // last frame to read ahead
+	bool stop = false;
+
+	FrameReader(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+
+	// fault in the pages of the frames up to the target, one frame at a time
+	void prefetch_loop()
+	{
+		ThreadPool::pin_current(0);
+		std::unique_lock<std::mutex> lock(this->mutex);
+		while (true)
+		{
+			this->cond.wait(lock, [this]() { return this->stop || this->next <= this->target; });
+			if (this->stop)
+			{
+				return;
+			}
+			const size_t k = this->next++;
+			lock.unlock();
+			this->file.advise(this->offsets[k], this->bytes, true);
+			this->file.touch(this->offsets[k], this->bytes);
+			lock.lock();
+		}
+	}
+};
+
+// sequence of frames written in place into a memory-mapped file, in the layouts of FrameReader
+// frames are appended, the file grows by chunks of frames and is truncated to the written ones when closed
+// *** not thread-safe, appending a frame may remap the file, invalidating the previous pointers ***
+class FrameWriter
+{
+public:
+	typedef FrameWriter Tthis;
+	typedef zimgxx::zimage_format Zformat;
+
+	// params are the y4m header tags other than the geometry (such as "F30000:1001 Ip A1:1")
+	FrameWriter(const std::string &path, const Zformat &format, bool y4m = false, const std::string &params = "")
+		: file(path, true), format(format), y4m(y4m), bytes(frame_size(format)), count(0)
+	{
+		this->header = y4m ? Y4m::make_header(format, params) : std::string();
+		this->stride = (y4m ? std::strlen(frame_tag()) : 0) + this->bytes;
+		this->grow(1);
+		std::memcpy(this->file.data(), this->header.data(), this->header.size());
+	}
+
+	~FrameWriter()
+	{
+		try
+		{
+			this->close();
+		}
+		catch (...) // nowhere to report it
+		{
+		}
+	}
+
+	const Zformat &getFormat() const { return this->format; }
+	bool isY4m() const { return this->y4m; }
+	size_t getCount() const { return this->count; }
+	size_t getFrameSize() const { return this->bytes; }
+
+	// append a frame, return its data to be written, valid until the next frame is appended
+	uint8_t *append()
+	{
+		if (!this->file.data())
+		{
+			throw std::runtime_error("Frame writer is closed");
+		}
+		this->grow(this->count + 1);
+		uint8_t *ptr = this->file.data() + this->header.size() + this->count * this->stride;
+		if (this->y4m)
+		{
+			std::memcpy(ptr, frame_tag(), std::strlen(frame_tag()));
+			ptr += std::strlen(frame_tag());
+		}
+		++this->count;
+		return ptr;
+	}
+
+	// truncate the file to the written frames and unmap it
+	void close()
+	{
+		if (this->file.data())
+		{
+			this->file.resize(this->header.size() + this->count * this->stride);
+		}
+		this->file.close();
+	}
+
+protected:
+	MappedFile file;
+	Zformat format;
+	bool y4m;
+	size_t bytes; // size of the data of a frame
+	size_t stride; // size of a frame, including the FRAME line
+	size_t count;
+	std::string header;
+
+	FrameWriter(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+
+	static const char *frame_tag() { return "FRAME\n"; }
+
+	// make room for the number of frames, by chunks of at least 16 frames and 64 MB
+	void grow(size_t frames)
+	{
+		const size_t needed = this->header.size() + frames * this->stride;
+		if (needed > this->file.size())
+		{
+			const size_t chunk = std::max<size_t>(16 * this->stride, 64 << 20);
+			this->file.resize(std::max(needed, this->file.size() + chunk));
+		}
+	}
+};
@@ -1,6 +1,22 @@
 #include "pybind11/pybind11.h"
 #include "pybind11/numpy.h"
 #include "zimg_helper.hpp"
+#include "filter_cache.hpp"
+#include "cpu_tuner.hpp"
+#include "frame_file.hpp"
+#include "thread_pool.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 ////////
 
@@ -10,179 +26,2553 @@ template <typename T>
 using PyArr = py::array_t<T, py::array::forcecast>;
 //using PyArr = py::array_t<T, py::array::c_style | py::array::forcecast>;
 
-////////
+// element of NumPy float16 arrays, only copied around as the values are converted by zimg
+struct float16
+{
+	uint16_t bits;
+};
+
+namespace pybind11
+{
+	namespace detail
+	{
+		template <>
+		struct npy_format_descriptor<float16>
+		{
+#if PYBIND11_VERSION_HEX >= 0x02090000
+			static constexpr auto name = const_name("float16");
+#else
+			static constexpr auto name = _("float16");
+#endif
+			static pybind11::dtype dtype()
+			{
+				const int NPY_HALF = 23;
+				return reinterpret_steal<pybind11::dtype>(npy_api::get().PyArray_DescrFromType_(NPY_HALF));
+			}
+		};
+	}
+}
+
+// zimg pixel type of the array element types
+template <typename T> zimg_pixel_type_e pixel_type_of();
+template <> zimg_pixel_type_e pixel_type_of<uint8_t>() { return ZIMG_PIXEL_BYTE; }
+template <> zimg_pixel_type_e pixel_type_of<uint16_t>() { return ZIMG_PIXEL_WORD; }
+template <> zimg_pixel_type_e pixel_type_of<float16>() { return ZIMG_PIXEL_HALF; }
+template <> zimg_pixel_type_e pixel_type_of<float>() { return ZIMG_PIXEL_FLOAT; }
+
+// whether arrays of T can hold the pixels of the type,
+// uint16 arrays also hold the raw bits of HALF pixels, as before float16 arrays were supported
+template <typename T>
+static bool holds_pixels(zimg_pixel_type_e pixel_type)
+{
+	return pixel_type == pixel_type_of<T>() || (pixel_type == ZIMG_PIXEL_HALF && pixel_type_of<T>() == ZIMG_PIXEL_WORD);
+}
+
+// view an object as a NumPy array sharing its memory: arrays are used as they are,
+// DLPack producers (such as CPU tensors) go through numpy.from_dlpack, and other objects through the buffer protocol
+// return an empty object when the memory can't be shared
+static py::object array_view(const py::object &obj)
+{
+	if (py::isinstance<py::array>(obj))
+	{
+		return obj;
+	}
+	if (py::hasattr(obj, "__dlpack__"))
+	{
+		return py::module::import("numpy").attr("from_dlpack")(obj);
+	}
+	if (PyObject_CheckBuffer(obj.ptr()))
+	{
+		return py::array::ensure(obj);
+	}
+	return py::object();
+}
+
+// get an input as an array of T sharing its memory, see array_view(),
+// other objects, data types or layouts (for c_style) are copied with convert=true, and rejected otherwise
+template <typename T, int Flags = py::array::forcecast>
+static py::array_t<T, Flags> input_array(const py::object &src, bool convert)
+{
+	typedef py::array_t<T, Flags> Tarr;
+	const py::object view = array_view(src);
+	if (view && py::isinstance<Tarr>(view))
+	{
+		return py::reinterpret_borrow<Tarr>(view);
+	}
+	if (!convert)
+	{
+		throw py::type_error(std::string("Input must share its memory as ")
+			+ (Flags & py::array::c_style ? "a C-contiguous" : "an") + " array of the pixel type of the filter, "
+			+ "as a NumPy array, a DLPack producer or a buffer, pass convert=True to copy it instead");
+	}
+	return Tarr::ensure(view ? view : src);
+}
+
+////////
+
+// pending result of ZFilter.submit(), completed by a worker thread of the pool without the GIL
+// the arrays are referenced until the future is destroyed, which waits for the completion first
+class ZFuture
+{
+public:
+	typedef ZFuture Tthis;
+
+	// completion state shared with the task, which must not touch any Python object
+	struct State
+	{
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool finished = false;
+		std::exception_ptr error;
+		int notify_fd = -1;
+
+		void finish(std::exception_ptr error)
+		{
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->error = error;
+				this->finished = true;
+			}
+			this->cv.notify_all();
+			// written after finished is set, so a woken reader can't see the future pending,
+			// and outside of the mutex, as a full pipe would block done() and wait() otherwise
+			if (this->notify_fd >= 0)
+			{
+				const char byte = 0;
+#ifdef _WIN32
+				(void)_write(this->notify_fd, &byte, 1);
+#else
+				(void)!write(this->notify_fd, &byte, 1);
+#endif
+			}
+		}
+	};
+
+	ZFuture(std::shared_ptr<State> state, py::object src, py::object dst)
+		: state(std::move(state)), src(std::move(src)), dst(std::move(dst))
+	{}
+
+	~ZFuture()
+	{
+		// the task may still write into dst, and read from src
+		py::gil_scoped_release release;
+		this->wait(-1);
+	}
+
+	bool done() const
+	{
+		std::lock_guard<std::mutex> lock(this->state->mutex);
+		return this->state->finished;
+	}
+
+	// wait for the completion with the GIL released, a negative timeout waits forever
+	// return false on timeout
+	bool wait(double timeout) const
+	{
+		std::unique_lock<std::mutex> lock(this->state->mutex);
+		const auto finished = [this]() { return this->state->finished; };
+		if (timeout < 0)
+		{
+			this->state->cv.wait(lock, finished);
+			return true;
+		}
+		return this->state->cv.wait_for(lock, std::chrono::duration<double>(timeout), finished);
+	}
+
+	// return the target array, or raise the exception thrown while processing
+	py::object result(double timeout) const
+	{
+		bool finished;
+		{
+			py::gil_scoped_release release;
+			finished = this->wait(timeout);
+		}
+		if (!finished)
+		{
+			PyErr_SetString(PyExc_TimeoutError, "ZFilter task did not complete in time");
+			throw py::error_already_set();
+		}
+		if (this->state->error)
+		{
+			std::rethrow_exception(this->state->error);
+		}
+		return this->dst;
+	}
+
+protected:
+	std::shared_ptr<State> state;
+	py::object src;
+	py::object dst;
+
+	ZFuture(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+};
+
+class ZFilterPy
+	: public ZFilter
+{
+public:
+	typedef ZFilterPy Tthis;
+	typedef ZFilter Tbase;
+
+	// create an instance based on zimage format and zfilter graph params
+	// autotune=true replaces the cpu type with the fastest one on this CPU, see CpuTuner
+	ZFilterPy(const Zformat &src_format, const Zformat &dst_format, const Zparams &params,
+		bool concurrent = false, unsigned bands = 1, bool autotune = false)
+		: Tbase(src_format, dst_format, autotune ? tuned(src_format, dst_format, params) : params, concurrent)
+	{
+		if (bands != 1) this->setBands(bands);
+	}
+
+	// create an instance based on a custom resize parameters
+	// can only perform resizing without other colorspace conversions
+	ZFilterPy(const ZResizeParams &params,
+		unsigned src_width, unsigned src_height, unsigned dst_width, unsigned dst_height,
+		double roi_left = 0, double roi_top = 0, double roi_width = 0, double roi_height = 0,
+		bool concurrent = false, unsigned bands = 1, bool autotune = false)
+		: Tbase(autotune ? tune_cpu(params, src_width, src_height, dst_width, dst_height,
+				roi_left, roi_top, roi_width, roi_height) : params,
+			src_width, src_height, dst_width, dst_height,
+			roi_left, roi_top, roi_width, roi_height, concurrent)
+	{
+		if (bands != 1) this->setBands(bands);
+	}
+
+	// create a pipeline of several stages, see ZFilter::plan_stages
+	ZFilterPy(const std::vector<Stage> &stages, bool reorder = true, bool fuse = true,
+		bool concurrent = false, unsigned bands = 1, bool autotune = false)
+		: Tbase(autotune ? tune_cpu(plan_stages(stages, reorder, fuse)) : plan_stages(stages, reorder, fuse),
+			concurrent)
+	{
+		if (bands != 1) this->setBands(bands);
+	}
+
+	// graph params with the fastest cpu type on this CPU
+	static Zparams tuned(const Zformat &src_format, const Zformat &dst_format, Zparams params)
+	{
+		params.cpu_type = tune_cpu(src_format, dst_format, params);
+		return params;
+	}
+
+	// CpuTuner::tune() of the global tuner, with the GIL released while measuring the candidates,
+	// which takes a while on the first request, the tuner only locks its own mutex
+	template <typename... Args>
+	static auto tune_cpu(const Args &...args) -> decltype(CpuTuner::global().tune(args...))
+	{
+		py::gil_scoped_release release;
+		return CpuTuner::global().tune(args...);
+	}
+
+	// the GIL is only held while requesting buffers and allocating the output array,
+	// so different instances can process in parallel from multiple Python threads
+	// *** a single instance must not be called from multiple threads at the same time,
+	// unless it is a concurrent one ***
+	// channel_first=false takes and returns HWC (interleaved) data for 3-D and 4-D arrays
+	// 4-D arrays are processed as a batch of images,
+	// which can be spread across the thread pool with threads != 1 (0 means all the threads)
+	// out is an optional array the result is written into, instead of allocating a new one,
+	// it should have the expected shape and data type, and writeable non-overlapping strides,
+	// and should not share memory with src
+	template <typename T>
+	py::array __call__(PyArr<T> src_arr, bool channel_first, unsigned threads, py::object out)
+	{
+		if (!holds_pixels<T>(this->src_format.pixel_type))
+		{
+			throw std::runtime_error("Input data type must match the pixel type defined in the filter");
+		}
+
+		// the output data type follows the pixel type of the target format
+		switch (this->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->process_array<T, uint8_t>(src_arr, channel_first, threads, out);
+		case ZIMG_PIXEL_WORD:
+			return this->process_array<T, uint16_t>(src_arr, channel_first, threads, out);
+		case ZIMG_PIXEL_HALF:
+			return this->process_array<T, float16>(src_arr, channel_first, threads, out);
+		case ZIMG_PIXEL_FLOAT:
+			return this->process_array<T, float>(src_arr, channel_first, threads, out);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
+
+	// queue an image to be processed by a worker thread of the pool, return a ZFuture of the result
+	// the input is checked and the output allocated right away, with the GIL held,
+	// then the task only touches the raw buffers, which are kept alive by the future
+	// notify_fd is a file descriptor (e.g. the write end of a pipe) receiving a byte on completion,
+	// so an event loop can wait for it, it must stay open until the byte is written, after the future is done,
+	// and be non-blocking, so that a full pipe never blocks the worker thread
+	// any instance can be used, as the tasks always use the temp memory of their worker thread
+	template <typename T>
+	static std::unique_ptr<ZFuture> submit(std::shared_ptr<Tthis> self,
+		PyArr<T> src_arr, bool channel_first, py::object out, int notify_fd)
+	{
+		if (!holds_pixels<T>(self->src_format.pixel_type))
+		{
+			throw std::runtime_error("Input data type must match the pixel type defined in the filter");
+		}
+
+		// the output data type follows the pixel type of the target format
+		switch (self->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return submit_array<T, uint8_t>(self, src_arr, channel_first, out, notify_fd);
+		case ZIMG_PIXEL_WORD:
+			return submit_array<T, uint16_t>(self, src_arr, channel_first, out, notify_fd);
+		case ZIMG_PIXEL_HALF:
+			return submit_array<T, float16>(self, src_arr, channel_first, out, notify_fd);
+		case ZIMG_PIXEL_FLOAT:
+			return submit_array<T, float>(self, src_arr, channel_first, out, notify_fd);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
+
+	// __call__ for the inputs which aren't NumPy arrays of a supported element type,
+	// DLPack producers and buffers are used in place as arrays, see input_array()
+	py::array call_any(py::object src, bool channel_first, unsigned threads, py::object out, bool convert)
+	{
+		return this->visit_input(src, convert, [&](auto arr) { return this->__call__(arr, channel_first, threads, out); });
+	}
+
+	static std::unique_ptr<ZFuture> submit_any(std::shared_ptr<Tthis> self,
+		py::object src, bool channel_first, py::object out, int notify_fd, bool convert)
+	{
+		return self->visit_input(src, convert, [&](auto arr) { return submit(self, arr, channel_first, out, notify_fd); });
+	}
+
+	// process through row callbacks, so that neither image has to be entirely in memory
+	// reader(i) returns the source row i, writer(i, left, row) receives the columns [left, left + width)
+	// of the target row i, each row is a (width,) array for a single channel,
+	// (channels, width) with channel_first=true, or (width, channels) with channel_first=false
+	// source rows may be read again when the graph processes the image in column tiles,
+	// and target rows are written once per column tile
+	// the GIL is released while processing, and acquired again for each call of reader or writer
+	void stream(py::object reader, py::object writer, bool channel_first)
+	{
+		switch (this->src_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->stream_to<uint8_t>(reader, writer, channel_first);
+		case ZIMG_PIXEL_WORD:
+			return this->stream_to<uint16_t>(reader, writer, channel_first);
+		case ZIMG_PIXEL_HALF:
+			return this->stream_to<float16>(reader, writer, channel_first);
+		case ZIMG_PIXEL_FLOAT:
+			return this->stream_to<float>(reader, writer, channel_first);
+		default:
+			throw std::runtime_error("Unsupported input pixel type");
+		}
+	}
+
+	// process an image given as one 2-D array per plane, chroma planes are sized after the subsampling
+	// return the list of the target planes
+	py::object planes(py::sequence src, bool convert)
+	{
+		return this->process_layout(src, LAYOUT_PLANES, convert);
+	}
+
+	// process an image stored in a single continuous buffer, with the planes one after another (I420),
+	// or with semi_planar=true, the chroma planes interleaved in a single plane (NV12)
+	// the target is stored in the same layout, a 1-D input gives a 1-D output,
+	// otherwise it has as many rows of the target width as fit
+	py::object packed(py::object src, bool semi_planar, bool convert)
+	{
+		return this->process_layout(src, semi_planar ? LAYOUT_SEMIPLANAR : LAYOUT_PLANAR, convert);
+	}
+
+	// resize several regions of a single image to the target size, in one call
+	// rois is a sequence of (left, top, width, height) in source pixels, replacing the active region of the filter
+	// the result is a batch of every crop, NCHW with channel_first=true and NHWC otherwise, even for a single channel
+	// the source is copied into aligned memory at most once, and each crop runs a graph on the window
+	// of the source its filter reads, so crops with the same size and offset within their window share a graph
+	// crops can be spread across the thread pool with threads != 1 (0 means all the threads)
+	py::array crops(py::object src, py::sequence rois, bool channel_first, unsigned threads, py::object out, bool convert)
+	{
+		return this->visit_input(src, convert, [&](auto arr) { return this->crops_to(arr, rois, channel_first, threads, out); });
+	}
+
+	// convert the frames [first, first + count) of a reader, appending them to a writer,
+	// count=0 means all the following frames, return the number of frames converted
+	// the planes are read and written in place in the mapped files when aligned, and copied through temp memory otherwise
+	// the GIL is released for the whole sequence
+	size_t frames(FrameReader &reader, FrameWriter &writer, size_t first, size_t count)
+	{
+		if (!same_geometry(reader.getFormat(), this->src_format) || !same_geometry(writer.getFormat(), this->dst_format))
+		{
+			throw std::runtime_error("Frames of the files must match the formats of the filter");
+		}
+		if (first > reader.getCount())
+		{
+			throw std::out_of_range("First frame out of range");
+		}
+		switch (this->src_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->frames_to<uint8_t>(reader, writer, first, count);
+		case ZIMG_PIXEL_WORD:
+			return this->frames_to<uint16_t>(reader, writer, first, count);
+		case ZIMG_PIXEL_HALF:
+			return this->frames_to<float16>(reader, writer, first, count);
+		case ZIMG_PIXEL_FLOAT:
+			return this->frames_to<float>(reader, writer, first, count);
+		default:
+			throw std::runtime_error("Unsupported input pixel type");
+		}
+	}
+
+	// process a single image in tiles of the target, so that each tile only needs its window of the source
+	// each tile runs a graph on the window its filter reads, tiles sharing the same formats share a graph,
+	// and the result matches processing the whole image, up to the rounding of the filter positions when resizing
+	// memory-mapped arrays (numpy.memmap) can be used for both src and out, their pages are touched tile by tile
+	// tiles can be spread across the thread pool with threads != 1 (0 means all the threads)
+	py::array tiled(py::object src, unsigned tile_width, unsigned tile_height,
+		bool channel_first, unsigned threads, py::object out, bool convert)
+	{
+		return this->visit_input(src, convert, [&](auto arr)
+		{
+			return this->tiles_to(arr, tile_width, tile_height, channel_first, threads, out);
+		});
+	}
+
+protected:
+	enum Layout
+	{
+		LAYOUT_PLANES, // one array per plane
+		LAYOUT_PLANAR, // planes one after another in a single buffer
+		LAYOUT_SEMIPLANAR // luma plane followed by interleaved chroma planes
+	};
+
+	// strided view of a (batch of) CHW or HWC image inside a NumPy buffer
+	// note that strides are based on BYTES
+	struct ArrView
+	{
+		void *ptr;
+		ssize_t count, channels, height, width;
+		ssize_t stride_n, stride_c, stride_h, stride_w;
+		ssize_t axis_c, axis_h, axis_w;
+
+		// HW for 2-D, CHW or HWC for 3-D, NCHW or NHWC for 4-D
+		ArrView(const py::buffer_info &buf, bool channel_first)
+			: ptr(buf.ptr)
+		{
+			const ssize_t ndim = buf.ndim;
+			const ssize_t axis_n = ndim > 3 ? 0 : -1;
+			const ssize_t axis_c = ndim - (axis_n + 1) < 3 ? -1 : channel_first ? axis_n + 1 : ndim - 1;
+			this->axis_c = axis_c;
+			this->axis_h = axis_c == axis_n + 1 ? axis_c + 1 : axis_n + 1;
+			this->axis_w = this->axis_h + 1;
+			this->count = axis_n < 0 ? 1 : buf.shape[axis_n];
+			this->channels = axis_c < 0 ? 1 : buf.shape[axis_c];
+			this->height = buf.shape[this->axis_h];
+			this->width = buf.shape[this->axis_w];
+			this->stride_n = axis_n < 0 ? 0 : buf.strides[axis_n];
+			this->stride_c = axis_c < 0 ? 0 : buf.strides[axis_c];
+			this->stride_h = buf.strides[this->axis_h];
+			this->stride_w = buf.strides[this->axis_w];
+		}
+
+		ArrView()
+			: ptr(nullptr), count(0), channels(0), height(0), width(0),
+			stride_n(0), stride_c(0), stride_h(0), stride_w(0), axis_c(-1), axis_h(-1), axis_w(-1)
+		{}
+
+		// a single row, W for 1-D, CW or WC for 2-D
+		static ArrView row(const py::buffer_info &buf, bool channel_first)
+		{
+			const ssize_t axis_c = buf.ndim < 2 ? -1 : channel_first ? 0 : 1;
+			const ssize_t axis_w = axis_c == 0 ? 1 : 0;
+			ArrView view;
+			view.ptr = buf.ptr;
+			view.count = 1;
+			view.channels = axis_c < 0 ? 1 : buf.shape[axis_c];
+			view.height = 1;
+			view.width = buf.shape[axis_w];
+			view.stride_c = axis_c < 0 ? 0 : buf.strides[axis_c];
+			view.stride_w = buf.strides[axis_w];
+			view.axis_c = axis_c;
+			view.axis_w = axis_w;
+			return view;
+		}
+
+		// a continuous plane, optionally holding interleaved channels
+		static ArrView packed(void *ptr, ssize_t width, ssize_t height, ssize_t channels, size_t elem_size)
+		{
+			ArrView view;
+			view.ptr = ptr;
+			view.count = 1;
+			view.channels = channels;
+			view.height = height;
+			view.width = width;
+			view.stride_c = channels > 1 ? elem_size : 0;
+			view.stride_w = elem_size * channels;
+			view.stride_h = view.stride_w * width;
+			view.axis_c = -1;
+			view.axis_h = 0;
+			view.axis_w = 1;
+			return view;
+		}
+
+		// size of the data in bytes
+		uint64_t bytes(size_t elem_size) const
+		{
+			return static_cast<uint64_t>(this->count) * this->channels * this->height * this->width * elem_size;
+		}
+
+		// view of the n-th image in the batch
+		ArrView image(ssize_t n) const
+		{
+			ArrView view = *this;
+			view.ptr = static_cast<uint8_t *>(this->ptr) + n * this->stride_n;
+			view.count = 1;
+			return view;
+		}
+
+		// view of the pixels [left, left + width) x [top, top + height) of a single image
+		ArrView window(ssize_t left, ssize_t top, ssize_t width, ssize_t height) const
+		{
+			ArrView view = *this;
+			view.ptr = static_cast<uint8_t *>(this->ptr) + top * this->stride_h + left * this->stride_w;
+			view.width = width;
+			view.height = height;
+			return view;
+		}
+	};
+
+	template <typename T, typename U>
+	PyArr<U> process_array(PyArr<T> &src_arr, bool channel_first, unsigned threads, py::object &out)
+	{
+		FilterStats::Timer prepare(this->stats, FilterStats::PHASE_PREPARE);
+		PyArr<U> dst_arr = this->prepare_array<T, U>(src_arr, channel_first, out);
+		const ArrView src_view(src_arr.request(), channel_first);
+		const ArrView dst_view(dst_arr.request(true), channel_first);
+		prepare.stop();
+		this->stats.addCall(src_view.count, src_view.bytes(sizeof(T)), dst_view.bytes(sizeof(U)));
+
+		// release the GIL, the remaining work only touches the raw buffers,
+		// which are kept alive by src_arr and dst_arr
+		{
+			py::gil_scoped_release release;
+			this->process_views<T, U>(src_view, dst_view, threads, false);
+		}
+
+		// return array
+		return dst_arr;
+	}
+
+	template <typename T, typename U>
+	static std::unique_ptr<ZFuture> submit_array(const std::shared_ptr<Tthis> &self,
+		PyArr<T> &src_arr, bool channel_first, py::object &out, int notify_fd)
+	{
+		FilterStats::Timer prepare(self->stats, FilterStats::PHASE_PREPARE);
+		PyArr<U> dst_arr = self->prepare_array<T, U>(src_arr, channel_first, out);
+		const ArrView src_view(src_arr.request(), channel_first);
+		const ArrView dst_view(dst_arr.request(true), channel_first);
+		prepare.stop();
+		self->stats.addCall(src_view.count, src_view.bytes(sizeof(T)), dst_view.bytes(sizeof(U)));
+
+		auto state = std::make_shared<ZFuture::State>();
+		state->notify_fd = notify_fd;
+
+		// the task holds the filter, but no Python object, so it never needs the GIL,
+		// which is released while queuing it, as the pool may have to start its spare thread
+		{
+			py::gil_scoped_release release;
+			ThreadPool::global().submit([self, state, src_view, dst_view]()
+			{
+				std::exception_ptr error;
+				try
+				{
+					self->process_views<T, U>(src_view, dst_view, 1, true);
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+				state->finish(error);
+			});
+		}
+		return std::unique_ptr<ZFuture>(new ZFuture(state, src_arr, dst_arr));
+	}
+
+	// check the input array and return the array to write the result into
+	template <typename T, typename U>
+	PyArr<U> prepare_array(PyArr<T> &src_arr, bool channel_first, py::object &out)
+	{
+		// src protobuf
+		py::buffer_info src_buf = src_arr.request();
+		const ssize_t ndim = src_buf.ndim;
+
+		if (ndim < 2 || ndim > 4)
+		{
+			throw std::runtime_error("Number of dimensions must be 2, 3 or 4");
+		}
+
+		const ArrView src_view(src_buf, channel_first);
+		const ssize_t channels = src_view.channels;
+
+		if (channels != plane_count(this->src_format))
+		{
+			throw std::runtime_error("Number of channels must match the planes of the input format, including alpha");
+		}
+		if (this->src_format.subsample_w || this->src_format.subsample_h
+			|| this->dst_format.subsample_w || this->dst_format.subsample_h)
+		{
+			throw std::runtime_error("Chroma subsampled formats must be processed with planes() or packed()");
+		}
+		if (src_view.width != this->src_format.width || src_view.height != this->src_format.height)
+		{
+			throw std::runtime_error("Input width and height must match the format defined in the filter");
+		}
+
+		// dst protobuf
+		// planar rows are padded to the memory alignment, so zimg can write into it directly
+		// interleaved data is always copied, thus kept continuous
+		std::vector<ssize_t> dst_shape = src_buf.shape;
+		dst_shape[src_view.axis_w] = this->dst_format.width;
+		dst_shape[src_view.axis_h] = this->dst_format.height;
+		if (src_view.axis_c >= 0)
+		{
+			dst_shape[src_view.axis_c] = plane_count(this->dst_format);
+		}
+		else if (plane_count(this->dst_format) > 1)
+		{
+			throw std::runtime_error("Output with several planes requires an input with a channel axis");
+		}
+		return !out.is_none() ? output_array<U>(out, dst_shape, src_buf)
+			: channel_first || ndim < 3 ? aligned_array<U>(dst_shape, this->layout) : PyArr<U>(dst_shape);
+	}
+
+	// process a (batch of) image between raw buffers, the GIL should not be held
+	// local=true uses the temp memory of the calling thread even for a single image
+	template <typename T, typename U>
+	void process_views(const ArrView &src_view, const ArrView &dst_view, unsigned threads, bool local)
+	{
+		const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+		const ssize_t count = src_view.count;
+
+		if (threads == 1 || count == 1) // process images one by one, reusing the same temp memory
+		{
+			for (ssize_t n = 0; n < count; ++n)
+			{
+				this->process_image<T, U>(src_view.image(n), dst_view.image(n), simd, local);
+			}
+		}
+		else // spread images across the thread pool, each thread reuses its own temp memory
+		{
+			ThreadPool &pool = ThreadPool::global();
+			const ssize_t chunks = std::min<ssize_t>(count, threads ? threads : pool.size());
+			pool.parallel_for(chunks, [&](size_t k)
+			{
+				for (ssize_t n = k * count / chunks; n < static_cast<ssize_t>(k + 1) * count / chunks; ++n)
+				{
+					this->process_image<T, U>(src_view.image(n), dst_view.image(n), simd, true);
+				}
+			}, static_cast<unsigned>(chunks));
+		}
+	}
+
+	template <typename T>
+	void stream_to(py::object &reader, py::object &writer, bool channel_first)
+	{
+		// the output data type follows the pixel type of the target format
+		switch (this->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->stream_lines<T, uint8_t>(reader, writer, channel_first);
+		case ZIMG_PIXEL_WORD:
+			return this->stream_lines<T, uint16_t>(reader, writer, channel_first);
+		case ZIMG_PIXEL_HALF:
+			return this->stream_lines<T, float16>(reader, writer, channel_first);
+		case ZIMG_PIXEL_FLOAT:
+			return this->stream_lines<T, float>(reader, writer, channel_first);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
+
+	template <typename T, typename U>
+	void stream_lines(py::object &reader, py::object &writer, bool channel_first)
+	{
+		if (this->src_format.subsample_w || this->src_format.subsample_h
+			|| this->dst_format.subsample_w || this->dst_format.subsample_h)
+		{
+			throw std::runtime_error("Streaming doesn't support chroma subsampling");
+		}
+
+		this->stats.addCall(1, packed_size(this->src_format) * sizeof(T), packed_size(this->dst_format) * sizeof(U));
+		const LineBuffer src_lines = this->createSrcLines();
+		const LineBuffer dst_lines = this->createDstLines();
+		const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+		const ssize_t src_width = this->src_format.width;
+		const ssize_t dst_channels = dst_lines.getNumPlanes();
+		// image row held by each row of the source ring, so that rows requested again by column tiles are read once
+		std::vector<unsigned> held(src_lines.getRows(), ZIMG_BUFFER_MAX);
+
+		const Tcallback unpack = [&](unsigned i, unsigned, unsigned)
+		{
+			unsigned &slot = held[i & src_lines.getMask()];
+			if (slot == i)
+			{
+				return;
+			}
+			py::gil_scoped_acquire acquire;
+			// rows are never converted silently, as for the other inputs without convert=True
+			const py::object obj = reader(i);
+			if (!py::isinstance<PyArr<T>>(obj))
+			{
+				throw py::type_error("Reader must return NumPy arrays of the pixel type of the filter");
+			}
+			PyArr<T> row = py::reinterpret_borrow<PyArr<T>>(obj);
+			py::buffer_info buf = row.request();
+			const ArrView view = ArrView::row(buf, channel_first);
+			if (buf.ndim < 1 || buf.ndim > 2 || view.width != src_width || view.channels != src_lines.getNumPlanes())
+			{
+				throw std::runtime_error("Row returned by reader must match the width and channels of the input");
+			}
+			Image<T> planes = line_planes<T>(src_lines, i, 0, src_width);
+			import_planes(planes, view, simd);
+			slot = i;
+		};
+		const Tcallback pack = [&](unsigned i, unsigned left, unsigned right)
+		{
+			const ssize_t width = right - left;
+			py::gil_scoped_acquire acquire;
+			PyArr<U> row(dst_channels == 1 ? std::vector<ssize_t>{ width }
+				: channel_first ? std::vector<ssize_t>{ dst_channels, width } : std::vector<ssize_t>{ width, dst_channels });
+			py::buffer_info buf = row.request(true);
+			export_planes(line_planes<U>(dst_lines, i, left, width), ArrView::row(buf, channel_first), simd);
+			writer(i, left, row);
+		};
+
+		py::gil_scoped_release release;
+		Tbase::stream(src_lines, dst_lines, unpack, pack);
+	}
+
+	// call f with the input as an array of the element type of the source pixels
+	template <typename F>
+	auto visit_input(const py::object &src, bool convert, F &&f) -> decltype(f(PyArr<uint8_t>()))
+	{
+		switch (this->src_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return f(input_array<uint8_t>(src, convert));
+		case ZIMG_PIXEL_WORD:
+			return f(input_array<uint16_t>(src, convert));
+		case ZIMG_PIXEL_HALF:
+			return f(input_array<float16>(src, convert));
+		case ZIMG_PIXEL_FLOAT:
+			return f(input_array<float>(src, convert));
+		default:
+			throw std::runtime_error("Unsupported input pixel type");
+		}
+	}
+
+	py::object process_layout(py::object &src, Layout layout, bool convert)
+	{
+		switch (this->src_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->process_layout_to<uint8_t>(src, layout, convert);
+		case ZIMG_PIXEL_WORD:
+			return this->process_layout_to<uint16_t>(src, layout, convert);
+		case ZIMG_PIXEL_HALF:
+			return this->process_layout_to<float16>(src, layout, convert);
+		case ZIMG_PIXEL_FLOAT:
+			return this->process_layout_to<float>(src, layout, convert);
+		default:
+			throw std::runtime_error("Unsupported input pixel type");
+		}
+	}
+
+	template <typename T>
+	py::object process_layout_to(py::object &src, Layout layout, bool convert)
+	{
+		// the output data type follows the pixel type of the target format
+		switch (this->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->process_layout_impl<T, uint8_t>(src, layout, convert);
+		case ZIMG_PIXEL_WORD:
+			return this->process_layout_impl<T, uint16_t>(src, layout, convert);
+		case ZIMG_PIXEL_HALF:
+			return this->process_layout_impl<T, float16>(src, layout, convert);
+		case ZIMG_PIXEL_FLOAT:
+			return this->process_layout_impl<T, float>(src, layout, convert);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
+
+	template <typename T, typename U>
+	py::object process_layout_impl(py::object &src, Layout layout, bool convert)
+	{
+		FilterStats::Timer prepare(this->stats, FilterStats::PHASE_PREPARE);
+		const int c_style = py::array::c_style | py::array::forcecast;
+		const int src_planes = plane_count(this->src_format);
+		const int dst_planes = plane_count(this->dst_format);
+		if (layout == LAYOUT_SEMIPLANAR
+			&& (this->src_format.color_family == ZIMG_COLOR_GREY || this->dst_format.color_family == ZIMG_COLOR_GREY))
+		{
+			throw std::runtime_error("Semi-planar layout requires chroma planes");
+		}
+
+		std::vector<py::array> src_arrs;
+		std::vector<py::buffer_info> src_bufs;
+		std::vector<py::buffer_info> dst_bufs;
+		src_bufs.reserve(MAX_PLANES);
+		dst_bufs.reserve(MAX_PLANES);
+		ArrView src_parts[MAX_PLANES];
+		ArrView dst_parts[MAX_PLANES];
+		size_t src_count = 0;
+		size_t dst_count = 0;
+		py::object result;
+
+		if (layout == LAYOUT_PLANES)
+		{
+			py::sequence seq = py::reinterpret_borrow<py::sequence>(src);
+			if (static_cast<int>(py::len(seq)) != src_planes)
+			{
+				throw std::runtime_error("Number of planes must match the color family of the input format");
+			}
+			py::list dst_list;
+			for (int p = 0; p < src_planes; ++p)
+			{
+				PyArr<T> arr = input_array<T>(seq[p], convert);
+				if (!arr || arr.ndim() != 2 || arr.shape(0) != plane_height(this->src_format, p)
+					|| arr.shape(1) != plane_width(this->src_format, p))
+				{
+					throw std::runtime_error("Each plane must be a 2-D array sized after the input format and its subsampling");
+				}
+				src_arrs.push_back(arr);
+				src_bufs.push_back(arr.request());
+				src_parts[src_count++] = ArrView(src_bufs.back(), true);
+			}
+			for (int p = 0; p < dst_planes; ++p)
+			{
+				PyArr<U> arr = aligned_array<U>({ plane_height(this->dst_format, p), plane_width(this->dst_format, p) },
+					this->layout);
+				dst_bufs.push_back(arr.request(true));
+				dst_parts[dst_count++] = ArrView(dst_bufs.back(), true);
+				dst_list.append(arr);
+			}
+			result = dst_list;
+		}
+		else
+		{
+			const bool semi_planar = layout == LAYOUT_SEMIPLANAR;
+			py::array_t<T, c_style> arr = input_array<T, c_style>(src, convert);
+			if (!arr || arr.size() != packed_size(this->src_format))
+			{
+				throw std::runtime_error("Input size must match the packed layout of the input format");
+			}
+			src_arrs.push_back(arr);
+			src_bufs.push_back(arr.request());
+			src_count = packed_parts<T>(src_parts, src_bufs.back().ptr, this->src_format, semi_planar);
+
+			const ssize_t dst_size = packed_size(this->dst_format);
+			const ssize_t dst_width = this->dst_format.width;
+			PyArr<U> dst_arr = arr.ndim() > 1 && dst_size % dst_width == 0
+				? PyArr<U>(std::vector<ssize_t>{ dst_size / dst_width, dst_width })
+				: PyArr<U>(std::vector<ssize_t>{ dst_size });
+			dst_bufs.push_back(dst_arr.request(true));
+			dst_count = packed_parts<U>(dst_parts, dst_bufs.back().ptr, this->dst_format, semi_planar);
+			result = dst_arr;
+		}
+
+		prepare.stop();
+		this->stats.addCall(1, packed_size(this->src_format) * sizeof(T), packed_size(this->dst_format) * sizeof(U));
+
+		// release the GIL, the buffers are kept alive by the arrays
+		{
+			py::gil_scoped_release release;
+			const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+			this->process_parts<T, U>(src_parts, src_count, dst_parts, dst_count, simd, false);
+		}
+		return result;
+	}
+
+	template <typename T>
+	py::array crops_to(PyArr<T> src_arr, py::sequence &rois, bool channel_first, unsigned threads, py::object &out)
+	{
+		if (!holds_pixels<T>(this->src_format.pixel_type))
+		{
+			throw std::runtime_error("Input data type must match the pixel type defined in the filter");
+		}
+
+		// the output data type follows the pixel type of the target format
+		switch (this->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->process_crops<T, uint8_t>(src_arr, rois, channel_first, threads, out);
+		case ZIMG_PIXEL_WORD:
+			return this->process_crops<T, uint16_t>(src_arr, rois, channel_first, threads, out);
+		case ZIMG_PIXEL_HALF:
+			return this->process_crops<T, float16>(src_arr, rois, channel_first, threads, out);
+		case ZIMG_PIXEL_FLOAT:
+			return this->process_crops<T, float>(src_arr, rois, channel_first, threads, out);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
+
+	// graphs of the parts of an image processed separately (crops, tiles), shared by the parts with the same formats
+	// they are concurrent instances, as each of them may be used by several threads
+	class GraphSet
+	{
+	public:
+		// return the index of the graph of the formats, which is built by build()
+		size_t add(const Zformat &src_format, const Zformat &dst_format, const Zparams &params)
+		{
+			const auto found = this->index.emplace(FilterCache<ZFilter>::make_key(src_format, dst_format, params),
+				this->formats.size());
+			if (found.second)
+			{
+				this->formats.emplace_back(src_format, dst_format);
+			}
+			return found.first->second;
+		}
+
+		// build the graphs on the thread pool, as building is much slower than a lookup
+		void build(const Zparams &params, unsigned max_threads)
+		{
+			this->graphs.resize(this->formats.size());
+			ThreadPool::global().parallel_for(this->formats.size(), [&](size_t k)
+			{
+				this->graphs[k].reset(new ZFilter(this->formats[k].first, this->formats[k].second, params, true));
+			}, max_threads);
+		}
+
+		const Zformat &getSrcFormat(size_t k) const { return this->formats[k].first; }
+		const Zformat &getDstFormat(size_t k) const { return this->formats[k].second; }
+		ZFilter &operator[](size_t k) const { return *this->graphs[k]; }
+
+	protected:
+		std::vector<std::pair<Zformat, Zformat>> formats;
+		std::unordered_map<std::string, size_t> index;
+		std::vector<std::unique_ptr<ZFilter>> graphs;
+	};
+
+	// a region of the source, resized by the graph of its window starting at (left, top)
+	struct Crop
+	{
+		unsigned left;
+		unsigned top;
+		size_t graph;
+	};
+
+	template <typename T, typename U>
+	py::array process_crops(PyArr<T> &src_arr, py::sequence &rois, bool channel_first, unsigned threads, py::object &out)
+	{
+		FilterStats::Timer prepare(this->stats, FilterStats::PHASE_PREPARE);
+		if (!this->stages.empty())
+		{
+			throw std::runtime_error("Crops require a filter of a single graph");
+		}
+		if (this->src_format.subsample_w || this->src_format.subsample_h
+			|| this->dst_format.subsample_w || this->dst_format.subsample_h)
+		{
+			throw std::runtime_error("Crops don't support chroma subsampling");
+		}
+
+		// src protobuf
+		py::buffer_info src_buf = src_arr.request();
+		if (src_buf.ndim < 2 || src_buf.ndim > 3)
+		{
+			throw std::runtime_error("Number of dimensions of the source must be 2 or 3");
+		}
+		const ArrView src_view(src_buf, channel_first);
+		if (src_view.channels != plane_count(this->src_format))
+		{
+			throw std::runtime_error("Number of channels must match the planes of the input format, including alpha");
+		}
+		if (src_view.width != this->src_format.width || src_view.height != this->src_format.height)
+		{
+			throw std::runtime_error("Input width and height must match the format defined in the filter");
+		}
+
+		// window and graph of each crop, the windows start on aligned columns so they can be used in place,
+		// and the graphs are keyed by their formats, which only differ in the window size and active region
+		const unsigned align = static_cast<unsigned>(this->layout.alignment / sizeof(T));
+		std::vector<Crop> crops;
+		GraphSet graphs;
+		for (size_t k = 0; k < py::len(rois); ++k)
+		{
+			const py::sequence roi = py::reinterpret_borrow<py::sequence>(rois[k]);
+			if (py::len(roi) != 4)
+			{
+				throw std::runtime_error("Each region must be a (left, top, width, height) sequence");
+			}
+			const double left = roi[0].cast<double>();
+			const double top = roi[1].cast<double>();
+			const double width = roi[2].cast<double>();
+			const double height = roi[3].cast<double>();
+			if (!(width > 0 && height > 0 && left >= 0 && top >= 0
+				&& left + width <= this->src_format.width && top + height <= this->src_format.height))
+			{
+				throw std::runtime_error("Each region must have a positive size and lie inside the source image");
+			}
+
+			unsigned x0, x1, y0, y1;
+			support_span(x0, x1, this->params, left, width, this->dst_format.width, this->src_format.width, align);
+			support_span(y0, y1, this->params, top, height, this->dst_format.height, this->src_format.height);
+			Zformat format = with_size(this->src_format, x1 - x0, y1 - y0);
+			format.active_region.left = left - x0;
+			format.active_region.top = top - y0;
+			format.active_region.width = width;
+			format.active_region.height = height;
+
+			crops.push_back(Crop{ x0, y0, graphs.add(format, this->dst_format, this->params) });
+		}
+		if (crops.empty())
+		{
+			throw std::runtime_error("At least one region is required");
+		}
+
+		// dst protobuf, a batch of crops
+		const ssize_t count = static_cast<ssize_t>(crops.size());
+		const ssize_t channels = plane_count(this->dst_format);
+		const ssize_t dst_width = this->dst_format.width;
+		const ssize_t dst_height = this->dst_format.height;
+		const std::vector<ssize_t> dst_shape = channel_first
+			? std::vector<ssize_t>{ count, channels, dst_height, dst_width }
+			: std::vector<ssize_t>{ count, dst_height, dst_width, channels };
+		PyArr<U> dst_arr = !out.is_none() ? output_array<U>(out, dst_shape, src_buf)
+			: channel_first ? aligned_array<U>(dst_shape, this->layout) : PyArr<U>(dst_shape);
+		const ArrView dst_view(dst_arr.request(true), channel_first);
+		prepare.stop();
+		this->stats.addCall(count, src_view.bytes(sizeof(T)), dst_view.bytes(sizeof(U)));
+
+		// release the GIL, the buffers are kept alive by the arrays
+		{
+			py::gil_scoped_release release;
+			const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+			ThreadPool &pool = ThreadPool::global();
+			const unsigned max_threads = threads ? threads : pool.size();
+
+			graphs.build(this->params, max_threads);
+
+			// copy the source to temp memory once, unless it can be used directly
+			Image<T> src_views[1];
+			bool src_copy[1];
+			FilterStats::Timer alloc(this->stats, FilterStats::PHASE_ALLOC);
+			Image<T> src_image = part_planes(src_views, src_copy, &src_view, 1, this->getArena(false), ScratchArena::SLOT_SRC,
+				this->layout);
+			alloc.stop();
+			{
+				FilterStats::Timer copy_in(this->stats, FilterStats::PHASE_COPY_IN);
+				this->stats.addPath(true, src_copy[0] ? import_planes(src_views[0], src_view, simd)
+					: FilterStats::PATH_ZERO_COPY);
+			}
+
+			// process, each thread writes its crops through its own temp memory when required
+			FilterStats::Timer timer(this->stats, FilterStats::PHASE_PROCESS);
+			pool.parallel_for(crops.size(), [&](size_t n)
+			{
+				const Crop &crop = crops[n];
+				const Zformat &format = graphs.getSrcFormat(crop.graph);
+				typename Image<T>::TplaneArr planes;
+				for (int c = 0; c < src_image.getNumPlanes(); ++c)
+				{
+					uint8_t *data = reinterpret_cast<uint8_t *>(src_image.getData(c))
+						+ crop.top * src_image.getStride(c) + crop.left * sizeof(T);
+					planes[c] = ImagePlane<T>(format.width, format.height, src_image.getStride(c), data);
+				}
+				const Image<T> window(planes, src_image.getNumPlanes());
+
+				const ArrView target = dst_view.image(n);
+				Image<U> dst_views[1];
+				bool dst_copy[1];
+				Image<U> dst_image = part_planes(dst_views, dst_copy, &target, 1, ScratchArena::local(), ScratchArena::SLOT_DST,
+					this->layout);
+				graphs[crop.graph](dst_image, window, true);
+				this->stats.addPath(false, dst_copy[0] ? export_planes(dst_views[0], target, simd)
+					: FilterStats::PATH_ZERO_COPY);
+			}, max_threads);
+		}
+		return dst_arr;
+	}
+
+	template <typename T>
+	size_t frames_to(FrameReader &reader, FrameWriter &writer, size_t first, size_t count)
+	{
+		// the output data type follows the pixel type of the target format
+		switch (this->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->process_frames<T, uint8_t>(reader, writer, first, count);
+		case ZIMG_PIXEL_WORD:
+			return this->process_frames<T, uint16_t>(reader, writer, first, count);
+		case ZIMG_PIXEL_HALF:
+			return this->process_frames<T, float16>(reader, writer, first, count);
+		case ZIMG_PIXEL_FLOAT:
+			return this->process_frames<T, float>(reader, writer, first, count);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
+
+	template <typename T, typename U>
+	size_t process_frames(FrameReader &reader, FrameWriter &writer, size_t first, size_t count)
+	{
+		const size_t last = count ? std::min(reader.getCount(), first + count) : reader.getCount();
+		py::gil_scoped_release release;
+		const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+		ArrView src_parts[MAX_PLANES];
+		ArrView dst_parts[MAX_PLANES];
+		for (size_t k = first; k < last; ++k)
+		{
+			// the frame data is only read, the parts are shared with the writable views
+			const size_t src_count = packed_parts<T>(src_parts, const_cast<uint8_t *>(reader.frame(k)),
+				this->src_format, false);
+			const size_t dst_count = packed_parts<U>(dst_parts, writer.append(), this->dst_format, false);
+			this->stats.addCall(1, reader.getFrameSize(), writer.getFrameSize());
+			this->process_parts<T, U>(src_parts, src_count, dst_parts, dst_count, simd, false);
+		}
+		return last - first;
+	}
+
+	template <typename T>
+	py::array tiles_to(PyArr<T> src_arr, unsigned tile_width, unsigned tile_height,
+		bool channel_first, unsigned threads, py::object &out)
+	{
+		if (!holds_pixels<T>(this->src_format.pixel_type))
+		{
+			throw std::runtime_error("Input data type must match the pixel type defined in the filter");
+		}
+
+		// the output data type follows the pixel type of the target format
+		switch (this->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->process_tiles<T, uint8_t>(src_arr, tile_width, tile_height, channel_first, threads, out);
+		case ZIMG_PIXEL_WORD:
+			return this->process_tiles<T, uint16_t>(src_arr, tile_width, tile_height, channel_first, threads, out);
+		case ZIMG_PIXEL_HALF:
+			return this->process_tiles<T, float16>(src_arr, tile_width, tile_height, channel_first, threads, out);
+		case ZIMG_PIXEL_FLOAT:
+			return this->process_tiles<T, float>(src_arr, tile_width, tile_height, channel_first, threads, out);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
+
+	// a tile of the target, written by the graph of its source window
+	struct Tile
+	{
+		unsigned src_left;
+		unsigned src_top;
+		unsigned dst_left;
+		unsigned dst_top;
+		size_t graph;
+	};
+
+	template <typename T, typename U>
+	py::array process_tiles(PyArr<T> &src_arr, unsigned tile_width, unsigned tile_height,
+		bool channel_first, unsigned threads, py::object &out)
+	{
+		FilterStats::Timer prepare(this->stats, FilterStats::PHASE_PREPARE);
+		const Zformat &src = this->src_format;
+		const Zformat &dst = this->dst_format;
+		if (!this->stages.empty())
+		{
+			throw std::runtime_error("Tiled processing requires a filter of a single graph");
+		}
+		if (src.subsample_w || src.subsample_h || dst.subsample_w || dst.subsample_h)
+		{
+			throw std::runtime_error("Tiled processing doesn't support chroma subsampling");
+		}
+		// the rows and columns of the tiles must not depend on each other
+		if (src.field_parity != ZIMG_FIELD_PROGRESSIVE || dst.field_parity != ZIMG_FIELD_PROGRESSIVE
+			|| this->params.dither_type != ZIMG_DITHER_NONE)
+		{
+			throw std::runtime_error("Tiled processing doesn't support interlacing or dithering");
+		}
+		if (!tile_width || !tile_height)
+		{
+			throw std::runtime_error("Tile dimensions must be positive");
+		}
+
+		// src protobuf
+		py::buffer_info src_buf = src_arr.request();
+		const ssize_t ndim = src_buf.ndim;
+		if (ndim < 2 || ndim > 3)
+		{
+			throw std::runtime_error("Number of dimensions must be 2 or 3");
+		}
+		const ArrView src_view(src_buf, channel_first);
+		if (src_view.channels != plane_count(src))
+		{
+			throw std::runtime_error("Number of channels must match the planes of the input format, including alpha");
+		}
+		if (src_view.width != src.width || src_view.height != src.height)
+		{
+			throw std::runtime_error("Input width and height must match the format defined in the filter");
+		}
+
+		// dst protobuf, planar rows are padded to the memory alignment unless provided
+		std::vector<ssize_t> dst_shape = src_buf.shape;
+		dst_shape[src_view.axis_w] = dst.width;
+		dst_shape[src_view.axis_h] = dst.height;
+		if (src_view.axis_c >= 0)
+		{
+			dst_shape[src_view.axis_c] = plane_count(dst);
+		}
+		else if (plane_count(dst) > 1)
+		{
+			throw std::runtime_error("Output with several planes requires an input with a channel axis");
+		}
+		PyArr<U> dst_arr = !out.is_none() ? output_array<U>(out, dst_shape, src_buf)
+			: channel_first || ndim < 3 ? aligned_array<U>(dst_shape, this->layout) : PyArr<U>(dst_shape);
+		const ArrView dst_view(dst_arr.request(true), channel_first);
+
+		// window and graph of each tile, the windows of resized columns start on aligned columns
+		// so that they can be used in place
+		const auto &region = src.active_region;
+		const double region_left = std::isnan(region.left) ? 0 : region.left;
+		const double region_top = std::isnan(region.top) ? 0 : region.top;
+		const double region_width = std::isnan(region.width) ? src.width : region.width;
+		const double region_height = std::isnan(region.height) ? src.height : region.height;
+		const unsigned align = static_cast<unsigned>(this->layout.alignment / sizeof(T));
+		std::vector<Tile> tiles;
+		GraphSet graphs;
+		for (unsigned y = 0; y < dst.height; y += tile_height)
+		{
+			const unsigned y_end = std::min(dst.height, y + tile_height);
+			for (unsigned x = 0; x < dst.width; x += tile_width)
+			{
+				const unsigned x_end = std::min(dst.width, x + tile_width);
+				unsigned x0, x1, y0, y1;
+				double left, top, width, height;
+				tile_span(x0, x1, left, width, this->params, region_left, region_width, src.width, dst.width,
+					x, x_end, align);
+				tile_span(y0, y1, top, height, this->params, region_top, region_height, src.height, dst.height,
+					y, y_end);
+				Zformat src_tile = with_size(src, x1 - x0, y1 - y0);
+				src_tile.active_region.left = left;
+				src_tile.active_region.top = top;
+				src_tile.active_region.width = width;
+				src_tile.active_region.height = height;
+				const Zformat dst_tile = with_size(dst, x_end - x, y_end - y);
+				tiles.push_back(Tile{ x0, y0, x, y, graphs.add(src_tile, dst_tile, this->params) });
+			}
+		}
+		prepare.stop();
+		this->stats.addCall(1, src_view.bytes(sizeof(T)), dst_view.bytes(sizeof(U)));
+
+		// release the GIL, the buffers are kept alive by the arrays
+		{
+			py::gil_scoped_release release;
+			const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+			ThreadPool &pool = ThreadPool::global();
+			const unsigned max_threads = threads ? threads : pool.size();
+
+			graphs.build(this->params, max_threads);
+
+			// each thread copies its tiles through its own temp memory when required
+			FilterStats::Timer timer(this->stats, FilterStats::PHASE_PROCESS);
+			pool.parallel_for(tiles.size(), [&](size_t n)
+			{
+				const Tile &tile = tiles[n];
+				const Zformat &src_tile = graphs.getSrcFormat(tile.graph);
+				const Zformat &dst_tile = graphs.getDstFormat(tile.graph);
+				this->process_part<T, U>(graphs[tile.graph],
+					src_view.window(tile.src_left, tile.src_top, src_tile.width, src_tile.height),
+					dst_view.window(tile.dst_left, tile.dst_top, dst_tile.width, dst_tile.height), simd);
+			}, max_threads);
+		}
+		return dst_arr;
+	}
+
+	// process a part of an image with a concurrent graph, through the temp memory of the calling thread
+	template <typename T, typename U>
+	void process_part(ZFilter &graph, const ArrView &src_part, const ArrView &dst_part, bool simd)
+	{
+		ScratchArena &arena = ScratchArena::local();
+		Image<T> src_views[1];
+		Image<U> dst_views[1];
+		bool src_copy[1];
+		bool dst_copy[1];
+		Image<T> src_image = part_planes(src_views, src_copy, &src_part, 1, arena, ScratchArena::SLOT_SRC, this->layout);
+		Image<U> dst_image = part_planes(dst_views, dst_copy, &dst_part, 1, arena, ScratchArena::SLOT_DST, this->layout);
+		this->stats.addPath(true, src_copy[0] ? import_planes(src_views[0], src_part, simd)
+			: FilterStats::PATH_ZERO_COPY);
+		graph(dst_image, src_image, true);
+		this->stats.addPath(false, dst_copy[0] ? export_planes(dst_views[0], dst_part, simd)
+			: FilterStats::PATH_ZERO_COPY);
+	}
+
+	// dimensions of the plane p of a format, rounded up like frame_size()
+	static ssize_t plane_width(const Zformat &format, int p)
+	{
+		return is_chroma(format, p) ? (format.width + (1U << format.subsample_w) - 1) >> format.subsample_w : format.width;
+	}
+
+	static ssize_t plane_height(const Zformat &format, int p)
+	{
+		return is_chroma(format, p) ? (format.height + (1U << format.subsample_h) - 1) >> format.subsample_h : format.height;
+	}
+
+	// number of elements of a format in a single continuous buffer, the same for both layouts
+	static ssize_t packed_size(const Zformat &format)
+	{
+		ssize_t size = 0;
+		for (int p = 0; p < plane_count(format); ++p)
+		{
+			size += plane_width(format, p) * plane_height(format, p);
+		}
+		return size;
+	}
+
+	// split a single continuous buffer into the parts of the layout, return the number of parts
+	template <typename T>
+	static size_t packed_parts(ArrView *parts, void *ptr, const Zformat &format, bool semi_planar)
+	{
+		uint8_t *data = static_cast<uint8_t *>(ptr);
+		size_t count = 0;
+		for (int p = 0; p < plane_count(format); ++p)
+		{
+			const ssize_t width = plane_width(format, p);
+			const ssize_t height = plane_height(format, p);
+			const ssize_t channels = semi_planar && p == 1 ? 2 : 1; // chroma planes interleaved into one
+			parts[count++] = ArrView::packed(data, width, height, channels, sizeof(T));
+			data += width * height * channels * sizeof(T);
+			p += static_cast<int>(channels) - 1;
+		}
+		return count;
+	}
+
+	// refer to the columns [left, left + width) of the row i in every plane of a lines buffer
+	template <typename T>
+	static Image<T> line_planes(const LineBuffer &lines, unsigned i, unsigned left, ssize_t width)
+	{
+		typename Image<T>::TplaneArr planes;
+		for (int p = 0; p < lines.getNumPlanes(); ++p)
+		{
+			planes[p] = ImagePlane<T>(width, 1, lines.getStride(p), static_cast<T *>(lines.getRow(p, i)) + left);
+		}
+		return Image<T>(planes, lines.getNumPlanes());
+	}
+
+	// process a single image, copying through temp memory when the buffers can't be used directly
+	// the temp memory is allocated on first use, and reused by the following calls
+	template <typename T, typename U>
+	void process_image(const ArrView &src_view, const ArrView &dst_view, bool simd, bool local)
+	{
+		this->process_parts<T, U>(&src_view, 1, &dst_view, 1, simd, local);
+	}
+
+	// process an image stored in several parts, each part holding one or more consecutive planes,
+	// either planar (CHW) or interleaved (HWC)
+	// parts are referred to directly when they match the memory alignment,
+	// otherwise they are copied through temp memory from the scratch arena
+	template <typename T, typename U>
+	void process_parts(const ArrView *src_parts, size_t src_count,
+		const ArrView *dst_parts, size_t dst_count, bool simd, bool local)
+	{
+		ScratchArena &arena = this->getArena(local);
+		Image<T> src_views[MAX_PLANES];
+		Image<U> dst_views[MAX_PLANES];
+		bool src_copy[MAX_PLANES];
+		bool dst_copy[MAX_PLANES];
+		FilterStats::Timer alloc(this->stats, FilterStats::PHASE_ALLOC);
+		Image<T> src_image = part_planes(src_views, src_copy, src_parts, src_count, arena, ScratchArena::SLOT_SRC,
+			this->layout);
+		Image<U> dst_image = part_planes(dst_views, dst_copy, dst_parts, dst_count, arena, ScratchArena::SLOT_DST,
+			this->layout);
+		alloc.stop();
+
+		// copy src data to temp memory
+		{
+			FilterStats::Timer copy_in(this->stats, FilterStats::PHASE_COPY_IN);
+			for (size_t k = 0; k < src_count; ++k)
+			{
+				this->stats.addPath(true, src_copy[k] ? import_planes(src_views[k], src_parts[k], simd)
+					: FilterStats::PATH_ZERO_COPY);
+			}
+		}
+
+		// process
+		Tbase::operator()(dst_image, src_image, local);
+
+		// copy dst data from temp memory
+		{
+			FilterStats::Timer copy_out(this->stats, FilterStats::PHASE_COPY_OUT);
+			for (size_t k = 0; k < dst_count; ++k)
+			{
+				this->stats.addPath(false, dst_copy[k] ? export_planes(dst_views[k], dst_parts[k], simd)
+					: FilterStats::PATH_ZERO_COPY);
+			}
+		}
+	}
+
+	// collect the planes of all the parts into a single image
+	// views[k] holds the planes of the part k, copy[k] tells whether they are in temp memory,
+	// which is taken from one slot of the arena for all the parts
+	template <typename T>
+	static Image<T> part_planes(Image<T> *views, bool *copy, const ArrView *parts, size_t count,
+		ScratchArena &arena, int slot, const PlaneLayout &layout)
+	{
+		size_t temp_size = 0;
+		for (size_t k = 0; k < count; ++k)
+		{
+			views[k] = view_planes<T>(parts[k], layout.alignment);
+			copy[k] = !views[k].getNumPlanes();
+			if (copy[k])
+			{
+				temp_size += ImagePlane<T>::cal_stride(parts[k].width, layout) * parts[k].height * parts[k].channels;
+			}
+		}
+
+		uint8_t *temp = temp_size ? static_cast<uint8_t *>(arena.get(slot, temp_size, layout.alignment)) : nullptr;
+		typename Image<T>::TplaneArr planes;
+		int num_planes = 0;
+		for (size_t k = 0; k < count; ++k)
+		{
+			if (copy[k]) // CHW data
+			{
+				const ssize_t stride = ImagePlane<T>::cal_stride(parts[k].width, layout);
+				ImagePlane<T> chw(parts[k].width, parts[k].height * parts[k].channels, stride, temp);
+				views[k] = split_planes(chw, parts[k].channels);
+				temp += stride * parts[k].height * parts[k].channels;
+			}
+			for (int c = 0; c < views[k].getNumPlanes(); ++c)
+			{
+				planes[num_planes++] = views[k].getPlane(c);
+			}
+		}
+		return Image<T>(planes, num_planes);
+	}
+
+	// [lo, hi) range of the bytes spanned by the elements of a buffer, empty for an empty buffer
+	static std::pair<uintptr_t, uintptr_t> byte_extent(const py::buffer_info &buf)
+	{
+		uintptr_t lo = reinterpret_cast<uintptr_t>(buf.ptr);
+		uintptr_t hi = lo + buf.itemsize;
+		for (size_t d = 0; d < buf.shape.size(); ++d)
+		{
+			if (buf.shape[d] == 0)
+			{
+				return std::make_pair(lo, lo);
+			}
+			const ssize_t span = buf.strides[d] * (buf.shape[d] - 1);
+			if (span < 0) lo -= static_cast<uintptr_t>(-span);
+			else hi += static_cast<uintptr_t>(span);
+		}
+		return std::make_pair(lo, hi);
+	}
+
+	// validate an array provided by the caller for the output
+	// the array is used as it is, the data type should match exactly and no element should overlap
+	// the bounds of its memory shouldn't overlap the ones of src either (as numpy.shares_memory),
+	// since the graphs read source rows after writing target ones
+	// DLPack producers and buffers are written in place through a NumPy view, see array_view()
+	template <typename T>
+	static PyArr<T> output_array(py::object &out, const std::vector<ssize_t> &shape, const py::buffer_info &src)
+	{
+		const py::object view = array_view(out);
+		if (!view || !py::isinstance<py::array_t<T>>(view))
+		{
+			throw std::runtime_error("Output array must be a NumPy array of the output data type, "
+				"or share its memory as one through DLPack or the buffer protocol");
+		}
+		PyArr<T> arr = py::reinterpret_borrow<PyArr<T>>(view);
+		if (!arr.writeable())
+		{
+			throw std::runtime_error("Output array must be writeable");
+		}
+		if (arr.ndim() != static_cast<ssize_t>(shape.size())
+			|| !std::equal(shape.begin(), shape.end(), arr.shape()))
+		{
+			throw std::runtime_error("Output array must have the shape of the result");
+		}
+		const std::pair<uintptr_t, uintptr_t> dst_bytes = byte_extent(arr.request());
+		const std::pair<uintptr_t, uintptr_t> src_bytes = byte_extent(src);
+		if (dst_bytes.first < src_bytes.second && src_bytes.first < dst_bytes.second)
+		{
+			throw std::runtime_error("Output array must not share memory with the input");
+		}
+		// each axis should step over the whole extent of the inner ones, in any order
+		std::vector<std::pair<ssize_t, ssize_t>> axes; // (stride, extent)
+		for (ssize_t d = 0; d < arr.ndim(); ++d)
+		{
+			if (arr.strides(d) <= 0 || arr.strides(d) % sizeof(T))
+			{
+				throw std::runtime_error("Output array must have positive strides of whole elements");
+			}
+			axes.emplace_back(arr.strides(d), arr.shape(d));
+		}
+		std::sort(axes.begin(), axes.end());
+		ssize_t extent = sizeof(T);
+		for (const auto &axis : axes)
+		{
+			if (axis.second > 1)
+			{
+				if (axis.first < extent)
+				{
+					throw std::runtime_error("Output array must not have overlapping elements");
+				}
+				extent += axis.first * (axis.second - 1);
+			}
+		}
+		return arr;
+	}
+
+	// allocate an array with each row padded to the memory alignment, and beyond with padded strides
+	// the memory is owned by a capsule, which is released together with the array
+	template <typename T>
+	static PyArr<T> aligned_array(const std::vector<ssize_t> &shape, const PlaneLayout &layout = PlaneLayout())
+	{
+		const size_t alignment = layout.alignment;
+		const size_t ndim = shape.size();
+		std::vector<ssize_t> strides(ndim);
+		ssize_t size = ImagePlane<T>::cal_stride(shape[ndim - 1], layout);
+		strides[ndim - 1] = sizeof(T);
+		for (size_t i = ndim - 1; i > 0;)
+		{
+			strides[--i] = size;
+			size *= shape[i];
+		}
+
+		T *data = aligned_malloc<T>(std::max<size_t>(size, alignment), alignment);
+		if (!data)
+		{
+			throw std::bad_alloc();
+		}
+		py::capsule owner(data, [](void *ptr) { aligned_free(ptr); });
+		return PyArr<T>(shape, strides, data, owner);
+	}
+
+	// refer to the planes of a strided buffer
+	// return an empty image if the planes can't be passed to zimg directly
+	template <typename T>
+	static Image<T> view_planes(const ArrView &view, size_t alignment = ALIGNMENT)
+	{
+		typename Image<T>::TplaneArr planes;
+		if (view.stride_w != sizeof(T)) // not continuous elements
+		{
+			return Image<T>();
+		}
+		for (ssize_t c = 0; c < view.channels; ++c)
+		{
+			planes[c] = ImagePlane<T>(view.width, view.height, view.stride_h,
+				static_cast<uint8_t *>(view.ptr) + c * view.stride_c);
+			if (!planes[c].isAligned(alignment))
+			{
+				return Image<T>();
+			}
+		}
+		return Image<T>(planes, static_cast<int>(view.channels));
+	}
+
+	// split CHW data stored in a single plane into an image of several planes
+	template <typename T>
+	static Image<T> split_planes(ImagePlane<T> &chw, ssize_t channels)
+	{
+		typename Image<T>::TplaneArr planes;
+		const int64_t height = chw.getHeight() / channels;
+		for (ssize_t c = 0; c < channels; ++c)
+		{
+			planes[c] = ImagePlane<T>(chw.getWidth(), height, chw.getStride(),
+				reinterpret_cast<uint8_t *>(chw.getData()) + c * height * chw.getStride());
+		}
+		return Image<T>(planes, static_cast<int>(channels));
+	}
+
+	// whether the view holds packed interleaved channels (HWC)
+	template <typename T>
+	static bool is_interleaved(const ArrView &view)
+	{
+		return view.channels > 1 && view.stride_c == sizeof(T)
+			&& view.stride_w == static_cast<ssize_t>(view.channels * sizeof(T));
+	}
+
+	// copy a strided buffer to the planes of an image
+	template <typename T>
+	static FilterStats::Path import_planes(Image<T> &dst, const ArrView &src, bool simd)
+	{
+		const ssize_t width = src.width;
+		const ssize_t height = src.height;
+
+		if (is_interleaved<T>(src)) // packed channels, deinterleave with SIMD
+		{
+			T *planes[MAX_PLANES];
+			std::ptrdiff_t strides[MAX_PLANES];
+			for (int c = 0; c < dst.getNumPlanes(); ++c)
+			{
+				planes[c] = dst.getData(c);
+				strides[c] = dst.getStride(c);
+			}
+			if (deinterleave(planes, strides, static_cast<const T *>(src.ptr), src.stride_h,
+				dst.getNumPlanes(), width, height, simd))
+			{
+				return FilterStats::PATH_INTERLEAVE;
+			}
+		}
+
+		// elements spaced by a small number of elements are gathered with SIMD
+		const std::ptrdiff_t elem = sizeof(T);
+		const std::ptrdiff_t step = src.stride_w % elem ? 0 : src.stride_w / elem;
+		FilterStats::Path path = src.stride_w != sizeof(T) ? FilterStats::PATH_STRIDED : FilterStats::PATH_BITBLT;
+
+		for (int c = 0; c < dst.getNumPlanes(); ++c)
+		{
+			const uint8_t *origin_ptr = static_cast<const uint8_t *>(src.ptr) + c * src.stride_c;
+			uint8_t *target_ptr = reinterpret_cast<uint8_t *>(dst.getData(c));
+
+			if (src.stride_w != sizeof(T) && gather(reinterpret_cast<T *>(target_ptr), dst.getStride(c),
+				reinterpret_cast<const T *>(origin_ptr), src.stride_h, step, width, height, simd))
+			{
+				continue;
+			}
+			if (src.stride_w != sizeof(T)) // not continuous elements, element-wise copy
+			{
+				path = FilterStats::PATH_ELEMENTWISE;
+				for (ssize_t h = 0; h < height; ++h)
+				{
+					const uint8_t *origin_row = origin_ptr + h * src.stride_h;
+					T *target_row = reinterpret_cast<T *>(target_ptr + h * dst.getStride(c));
+
+					for (ssize_t w = 0; w < width; ++w)
+					{
+						target_row[w] = *reinterpret_cast<const T *>(origin_row + w * src.stride_w);
+					}
+				}
+			}
+			else // continuous elements, not aligned data, copy with bitblt
+			{
+				bitblt(target_ptr, dst.getStride(c), origin_ptr,
+					src.stride_h, width * sizeof(T), height, simd);
+			}
+		}
+		return path;
+	}
+
+	// copy the planes of an image to a strided buffer
+	template <typename T>
+	static FilterStats::Path export_planes(const Image<T> &src, const ArrView &dst, bool simd)
+	{
+		const ssize_t width = dst.width;
+		const ssize_t height = dst.height;
+
+		if (is_interleaved<T>(dst)) // packed channels, interleave with SIMD
+		{
+			const T *planes[MAX_PLANES];
+			std::ptrdiff_t strides[MAX_PLANES];
+			for (int c = 0; c < src.getNumPlanes(); ++c)
+			{
+				planes[c] = src.getData(c);
+				strides[c] = src.getStride(c);
+			}
+			if (interleave(static_cast<T *>(dst.ptr), dst.stride_h, planes, strides,
+				src.getNumPlanes(), width, height, simd))
+			{
+				return FilterStats::PATH_INTERLEAVE;
+			}
+		}
+
+		// elements spaced by a small number of elements are scattered with a fixed step
+		const std::ptrdiff_t elem = sizeof(T);
+		const std::ptrdiff_t step = dst.stride_w % elem ? 0 : dst.stride_w / elem;
+		FilterStats::Path path = dst.stride_w != sizeof(T) ? FilterStats::PATH_STRIDED : FilterStats::PATH_BITBLT;
+
+		for (int c = 0; c < src.getNumPlanes(); ++c)
+		{
+			const uint8_t *origin_ptr = reinterpret_cast<const uint8_t *>(src.getData(c));
+			uint8_t *target_ptr = static_cast<uint8_t *>(dst.ptr) + c * dst.stride_c;
+
+			if (dst.stride_w != sizeof(T) && scatter(reinterpret_cast<T *>(target_ptr), dst.stride_h,
+				reinterpret_cast<const T *>(origin_ptr), src.getStride(c), step, width, height))
+			{
+				continue;
+			}
+			if (dst.stride_w != sizeof(T)) // not continuous elements, element-wise copy
+			{
+				path = FilterStats::PATH_ELEMENTWISE;
+				for (ssize_t h = 0; h < height; ++h)
+				{
+					const T *origin_row = reinterpret_cast<const T *>(origin_ptr + h * src.getStride(c));
+					uint8_t *target_row = target_ptr + h * dst.stride_h;
+
+					for (ssize_t w = 0; w < width; ++w)
+					{
+						*reinterpret_cast<T *>(target_row + w * dst.stride_w) = origin_row[w];
+					}
+				}
+			}
+			else // continuous elements, not aligned data, copy with bitblt
+			{
+				bitblt(target_ptr, dst.stride_h, origin_ptr,
+					src.getStride(c), width * sizeof(T), height, simd, true);
+			}
+		}
+		return path;
+	}
+
+	// disable copy constructor and copy assignment, as tmp_buf should not be shared
+	ZFilterPy(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+};
+
+////////
+
+// ZFilter specialized for the pixel types, the number of planes and the layout at compile time
+// it processes a single C-contiguous image, HW for a single plane, CHW for planar or HWC for interleaved,
+// with the copy kernels selected at compile time instead of dispatched on the strides of each call
+// the other methods of ZFilter (batches, submit, stream...) are inherited as they are
+template <typename T, typename U, int C, bool Interleaved>
+class ZFilterFixed
+	: public ZFilterPy
+{
+public:
+	typedef ZFilterFixed<T, U, C, Interleaved> Tthis;
+	typedef ZFilterPy Tbase;
+	typedef py::array_t<T, py::array::c_style | py::array::forcecast> TsrcArr;
+	typedef std::integral_constant<bool, Interleaved && (C > 1)> Tinterleaved;
+
+	ZFilterFixed(const Zformat &src_format, const Zformat &dst_format, const Zparams &params,
+		bool concurrent = false)
+		: Tbase(src_format, dst_format, params, concurrent)
+	{
+		if (src_format.pixel_type != pixel_type_of<T>() || dst_format.pixel_type != pixel_type_of<U>())
+		{
+			throw std::runtime_error("Pixel types of the formats must match the data types of the fixed filter");
+		}
+		if (plane_count(src_format) != C || plane_count(dst_format) != C)
+		{
+			throw std::runtime_error("Formats must have the number of planes of the fixed filter, including alpha");
+		}
+		if (src_format.subsample_w || src_format.subsample_h || dst_format.subsample_w || dst_format.subsample_h)
+		{
+			throw std::runtime_error("Fixed filters don't support chroma subsampling");
+		}
+	}
+
+	// the GIL is only held while checking the input and allocating the output, as in ZFilter
+	py::array __call__(TsrcArr src_arr)
+	{
+		FilterStats::Timer prepare(this->stats, FilterStats::PHASE_PREPARE);
+		const std::vector<ssize_t> src_shape = shape(this->src_format);
+		if (static_cast<size_t>(src_arr.ndim()) != src_shape.size()
+			|| !std::equal(src_shape.begin(), src_shape.end(), src_arr.shape()))
+		{
+			throw std::runtime_error(C == 1 ? "Input shape must be (height, width) of the input format"
+				: Interleaved ? "Input shape must be (height, width, channels) of the input format"
+				: "Input shape must be (channels, height, width) of the input format");
+		}
+
+		// planar rows are padded to the memory alignment, so zimg can write into it directly
+		PyArr<U> dst_arr = Tinterleaved::value ? PyArr<U>(shape(this->dst_format))
+			: aligned_array<U>(shape(this->dst_format), this->layout);
+		const T *src = src_arr.data();
+		U *dst = dst_arr.mutable_data();
+		const std::ptrdiff_t dst_stride = dst_arr.strides(Tinterleaved::value ? 0 : C == 1 ? 0 : 1);
+		prepare.stop();
+		this->stats.addCall(1, src_arr.nbytes(), dst_arr.nbytes());
+
+		{
+			py::gil_scoped_release release;
+			this->run(src, dst, dst_stride);
+		}
+		return dst_arr;
+	}
+
+protected:
+	typedef std::array<void *, MAX_PLANES> Tplanes;
+	typedef std::array<const void *, MAX_PLANES> TplanesC;
+	typedef std::array<std::ptrdiff_t, MAX_PLANES> Tstrides;
+
+	static std::vector<ssize_t> shape(const Zformat &format)
+	{
+		const ssize_t h = format.height;
+		const ssize_t w = format.width;
+		return C == 1 ? std::vector<ssize_t>{ h, w }
+			: Interleaved ? std::vector<ssize_t>{ h, w, C } : std::vector<ssize_t>{ C, h, w };
+	}
+
+	void run(const T *src, U *dst, std::ptrdiff_t dst_stride)
+	{
+		const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+		ScratchArena &arena = this->getArena();
+		TplanesC src_planes = {};
+		Tstrides src_strides = {};
+		Tplanes dst_planes = {};
+		Tstrides dst_strides = {};
+
+		FilterStats::Timer copy_in(this->stats, FilterStats::PHASE_COPY_IN);
+		this->stats.addPath(true, import_planes(src_planes, src_strides, src, arena, simd, Tinterleaved()));
+		copy_in.stop();
+
+		FilterStats::Timer alloc(this->stats, FilterStats::PHASE_ALLOC);
+		U *temp = this->target_planes(dst_planes, dst_strides, dst, dst_stride, arena, Tinterleaved());
+		alloc.stop();
+
+		Tbase::operator()(dst_planes, src_planes, dst_strides, src_strides);
+
+		FilterStats::Timer copy_out(this->stats, FilterStats::PHASE_COPY_OUT);
+		this->stats.addPath(false, export_planes(dst, dst_stride, temp, dst_strides[0], simd, Tinterleaved()));
+	}
+
+	// planar source, passed in place when aligned, copied with bitblt otherwise
+	FilterStats::Path import_planes(TplanesC &planes, Tstrides &strides, const T *src,
+		ScratchArena &arena, bool simd, std::false_type) const
+	{
+		const unsigned width = this->src_format.width;
+		const unsigned height = this->src_format.height;
+		const std::ptrdiff_t pitch = width * sizeof(T);
+		const std::ptrdiff_t plane = pitch * height;
+		const size_t alignment = this->layout.alignment;
+		const bool aligned = reinterpret_cast<uintptr_t>(src) % alignment == 0 && pitch % alignment == 0;
+		const std::ptrdiff_t stride = aligned ? pitch : ImagePlane<T>::cal_stride(width, this->layout);
+		uint8_t *temp = aligned ? nullptr
+			: static_cast<uint8_t *>(arena.get(ScratchArena::SLOT_SRC, stride * height * C, alignment));
+
+		for (int c = 0; c < C; ++c)
+		{
+			const int index = plane_index(this->src_format, c);
+			const uint8_t *origin = reinterpret_cast<const uint8_t *>(src) + c * plane;
+			if (!aligned)
+			{
+				bitblt(temp + c * stride * height, stride, origin, pitch, pitch, height, simd);
+				origin = temp + c * stride * height;
+			}
+			planes[index] = origin;
+			strides[index] = stride;
+		}
+		return aligned ? FilterStats::PATH_ZERO_COPY : FilterStats::PATH_BITBLT;
+	}
+
+	// interleaved source, deinterleaved row by row with the kernel for C channels
+	FilterStats::Path import_planes(TplanesC &planes, Tstrides &strides, const T *src,
+		ScratchArena &arena, bool simd, std::true_type) const
+	{
+		const unsigned width = this->src_format.width;
+		const unsigned height = this->src_format.height;
+		const std::ptrdiff_t stride = ImagePlane<T>::cal_stride(width, this->layout);
+		uint8_t *temp = static_cast<uint8_t *>(arena.get(ScratchArena::SLOT_SRC, stride * height * C, this->layout.alignment));
+		T *rows[C];
+
+		for (int c = 0; c < C; ++c)
+		{
+			const int index = plane_index(this->src_format, c);
+			planes[index] = temp + c * stride * height;
+			strides[index] = stride;
+			rows[c] = reinterpret_cast<T *>(temp + c * stride * height);
+		}
+		for (unsigned h = 0; h < height; ++h, src += width * C)
+		{
+			deinterleave_row<T, C>(rows, src, width, simd);
+			for (int c = 0; c < C; ++c)
+			{
+				rows[c] = reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(rows[c]) + stride);
+			}
+		}
+		return FilterStats::PATH_INTERLEAVE;
+	}
+
+	// planar target, written in place as its rows are aligned, return no temp memory
+	U *target_planes(Tplanes &planes, Tstrides &strides, U *dst, std::ptrdiff_t dst_stride,
+		ScratchArena &, std::false_type) const
+	{
+		const std::ptrdiff_t plane = dst_stride * this->dst_format.height;
+		for (int c = 0; c < C; ++c)
+		{
+			const int index = plane_index(this->dst_format, c);
+			planes[index] = reinterpret_cast<uint8_t *>(dst) + c * plane;
+			strides[index] = dst_stride;
+		}
+		return nullptr;
+	}
+
+	// interleaved target, processed into temp memory in the order of the planes
+	U *target_planes(Tplanes &planes, Tstrides &strides, U *, std::ptrdiff_t,
+		ScratchArena &arena, std::true_type) const
+	{
+		const unsigned width = this->dst_format.width;
+		const unsigned height = this->dst_format.height;
+		const std::ptrdiff_t stride = ImagePlane<U>::cal_stride(width, this->layout);
+		uint8_t *temp = static_cast<uint8_t *>(arena.get(ScratchArena::SLOT_DST, stride * height * C, this->layout.alignment));
+		for (int c = 0; c < C; ++c)
+		{
+			const int index = plane_index(this->dst_format, c);
+			planes[index] = temp + c * stride * height;
+			strides[index] = stride;
+		}
+		return reinterpret_cast<U *>(temp);
+	}
+
+	FilterStats::Path export_planes(U *, std::ptrdiff_t, const U *, std::ptrdiff_t,
+		bool, std::false_type) const
+	{
+		return FilterStats::PATH_ZERO_COPY;
+	}
+
+	// interleave the temp planes row by row with the kernel for C channels
+	FilterStats::Path export_planes(U *dst, std::ptrdiff_t dst_stride, const U *temp, std::ptrdiff_t stride,
+		bool simd, std::true_type) const
+	{
+		const unsigned width = this->dst_format.width;
+		const unsigned height = this->dst_format.height;
+		const U *rows[C];
+		for (int c = 0; c < C; ++c)
+		{
+			rows[c] = reinterpret_cast<const U *>(reinterpret_cast<const uint8_t *>(temp) + c * stride * height);
+		}
+		for (unsigned h = 0; h < height; ++h)
+		{
+			interleave_row<U, C>(reinterpret_cast<U *>(reinterpret_cast<uint8_t *>(dst) + h * dst_stride), rows, width, simd);
+			for (int c = 0; c < C; ++c)
+			{
+				rows[c] = reinterpret_cast<const U *>(reinterpret_cast<const uint8_t *>(rows[c]) + stride);
+			}
+		}
+		return FilterStats::PATH_INTERLEAVE;
+	}
+};
+
+// image pyramid, each level halves the dimensions of the previous one, rounded up
+// the filter itself resizes the source to the first level, and each following level is resized
+// either from the previous level, or from the source with from_source=true, which is slower but sharper
+// chained levels read the previous one in place, from the output array when it is aligned planar memory,
+// and from temp memory otherwise, alternating between 2 slots of the arena so that the memory is reused;
+// levels from the source only depend on it, thus they can be spread across the thread pool
+// the other methods of ZFilter only process the first level
+class ZPyramidPy
+	: public ZFilterPy
+{
+public:
+	typedef ZPyramidPy Tthis;
+	typedef ZFilterPy Tbase;
+
+	ZPyramidPy(const ZResizeParams &params, unsigned width, unsigned height, unsigned count,
+		bool from_source = false, bool concurrent = false)
+		: Tbase(params, width, height, level_size(width, 1), level_size(height, 1), 0, 0, 0, 0, concurrent),
+		resize_params(params), from_source(from_source)
+	{
+		if (count < 1)
+		{
+			throw std::runtime_error("A pyramid requires at least one level");
+		}
+		if (count > 1 && level_size(width, count - 1) == 1 && level_size(height, count - 1) == 1)
+		{
+			throw std::runtime_error("Number of levels exceeds the dimensions of the image");
+		}
+		// the following levels are concurrent instances, always using the temp memory of the calling thread
+		for (unsigned k = 2; k <= count; ++k)
+		{
+			const unsigned base = from_source ? 0 : k - 1;
+			this->levels.emplace_back(new ZFilter(params, level_size(width, base), level_size(height, base),
+				level_size(width, k), level_size(height, k), 0, 0, 0, 0, true));
+		}
+	}
+
+	// dimension of a level, the level 0 is the source
+	static unsigned level_size(unsigned size, unsigned level)
+	{
+		for (unsigned k = 0; k < level; ++k)
+		{
+			size = (size + 1) / 2;
+		}
+		return size;
+	}
+
+	const ZResizeParams &getResizeParams() const { return this->resize_params; }
+	unsigned getLevels() const { return static_cast<unsigned>(this->levels.size()) + 1; }
+	bool isFromSource() const { return this->from_source; }
 
-class ZFilterPy
-	: public ZFilter
-{
-public:
-	typedef ZFilterPy Tthis;
-	typedef ZFilter Tbase;
+	// the GIL is only held while checking the input and allocating the outputs, as in ZFilter
+	// return the list of the levels, each in the layout of the source
+	py::list __call__(py::object src, bool channel_first, unsigned threads, bool convert)
+	{
+		return this->visit_input(src, convert, [&](auto arr) { return this->levels_to(arr, channel_first, threads); });
+	}
 
-	// create an instance based on zimage format and zfilter graph params
-	ZFilterPy(const Zformat &src_format, const Zformat &dst_format, const Zparams &params)
-		: Tbase(src_format, dst_format, params)
-	{}
+protected:
+	ZResizeParams resize_params;
+	bool from_source;
+	std::vector<std::unique_ptr<ZFilter>> levels; // the levels after the first one
 
-	// create an instance based on a custom resize parameters
-	// can only perform resizing without other colorspace conversions
-	ZFilterPy(const ZResizeParams &params,
-		unsigned src_width, unsigned src_height, unsigned dst_width, unsigned dst_height,
-		double roi_left = 0, double roi_top = 0, double roi_width = 0, double roi_height = 0)
-		: Tbase(params, src_width, src_height, dst_width, dst_height,
-			roi_left, roi_top, roi_width, roi_height)
-	{}
+	// filter of the level k, counted from 0 for the first one
+	ZFilter &level(size_t k)
+	{
+		return k ? *this->levels[k - 1] : *this;
+	}
 
 	template <typename T>
-	PyArr<T> __call__(PyArr<T> src_arr)
+	py::list levels_to(PyArr<T> src_arr, bool channel_first, unsigned threads)
+	{
+		if (!holds_pixels<T>(this->src_format.pixel_type))
+		{
+			throw std::runtime_error("Input data type must match the pixel type defined in the filter");
+		}
+
+		// the output data type follows the pixel type of the target format
+		switch (this->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->process_levels<T, uint8_t>(src_arr, channel_first, threads);
+		case ZIMG_PIXEL_WORD:
+			return this->process_levels<T, uint16_t>(src_arr, channel_first, threads);
+		case ZIMG_PIXEL_HALF:
+			return this->process_levels<T, float16>(src_arr, channel_first, threads);
+		case ZIMG_PIXEL_FLOAT:
+			return this->process_levels<T, float>(src_arr, channel_first, threads);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
+
+	template <typename T, typename U>
+	py::list process_levels(PyArr<T> &src_arr, bool channel_first, unsigned threads)
 	{
+		FilterStats::Timer prepare(this->stats, FilterStats::PHASE_PREPARE);
+
 		// src protobuf
 		py::buffer_info src_buf = src_arr.request();
-		const std::vector<ssize_t> src_shape = src_buf.shape;
 		const ssize_t ndim = src_buf.ndim;
-		const ssize_t src_width = src_shape[ndim - 1];
-		const ssize_t src_height = src_shape[ndim - 2];
-		const ssize_t channels = ndim > 2 ? src_shape[ndim - 3] : 1;
-
 		if (ndim < 2 || ndim > 3)
 		{
 			throw std::runtime_error("Number of dimensions must be 2 or 3");
 		}
-		if (channels != 1 && channels != 3)
+		const ArrView src_view(src_buf, channel_first);
+		if (src_view.channels != plane_count(this->src_format))
 		{
-			throw std::runtime_error("Number of channels must be 1 or 3 (CHW format)");
+			throw std::runtime_error("Number of channels must match the planes of the input format, including alpha");
 		}
-		if (src_width != this->src_format.width || src_height != this->src_format.height)
+		if (src_view.width != this->src_format.width || src_view.height != this->src_format.height)
 		{
 			throw std::runtime_error("Input width and height must match the format defined in the filter");
 		}
 
-		// allocate temp memory
-		const ssize_t dst_width = this->dst_format.width;
-		const ssize_t dst_height = this->dst_format.height;
-		ImagePlane<T> src_image(src_width, src_height * channels); // allocate CHW data
-		ImagePlane<T> dst_image(dst_width, dst_height * channels); // allocate CHW data
+		// dst protobuf, one array per level
+		// planar rows are padded to the memory alignment, so the levels are written and read in place
+		const ssize_t channels = plane_count(this->dst_format);
+		std::vector<PyArr<U>> dst_arrs;
+		std::vector<ArrView> dst_views;
+		uint64_t dst_bytes = 0;
+		for (unsigned k = 0; k < this->getLevels(); ++k)
+		{
+			const Zformat &format = this->level(k).getDstFormat();
+			const ssize_t w = format.width;
+			const ssize_t h = format.height;
+			const std::vector<ssize_t> shape = ndim < 3 ? std::vector<ssize_t>{ h, w }
+				: channel_first ? std::vector<ssize_t>{ channels, h, w } : std::vector<ssize_t>{ h, w, channels };
+			dst_arrs.push_back(channel_first || ndim < 3 ? aligned_array<U>(shape, this->layout) : PyArr<U>(shape));
+			dst_views.push_back(ArrView(dst_arrs.back().request(true), channel_first));
+			dst_bytes += dst_views.back().bytes(sizeof(U));
+		}
+		prepare.stop();
+		this->stats.addCall(1, src_view.bytes(sizeof(T)), dst_bytes);
 
-		// dst protobuf
-		std::vector<ssize_t> dst_shape = src_buf.shape;
-		dst_shape[ndim - 1] = dst_width;
-		dst_shape[ndim - 2] = dst_height;
-		PyArr<T> dst_arr(dst_shape);
-		py::buffer_info dst_buf = dst_arr.request();
+		// release the GIL, the buffers are kept alive by the arrays
+		{
+			py::gil_scoped_release release;
+			this->process_level_views<T, U>(src_view, dst_views, threads);
+		}
+
+		py::list result;
+		for (const PyArr<U> &arr : dst_arrs)
+		{
+			result.append(arr);
+		}
+		return result;
+	}
+
+	template <typename T, typename U>
+	void process_level_views(const ArrView &src_view, const std::vector<ArrView> &dst_views, unsigned threads)
+	{
+		const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+		ScratchArena &arena = this->getArena(false);
 
-		// copy src data to aligned memory
-		const std::vector<ssize_t> src_strides = src_buf.strides;
-		const ssize_t src_stride_c = ndim > 2 ? src_strides[ndim - 3] : 0;
-		const ssize_t src_stride_h = src_strides[ndim - 2];
-		const ssize_t src_stride_w = src_strides[ndim - 1];
+		// copy the source to temp memory once, unless it can be used directly
+		Image<T> src_views[1];
+		bool src_copy[1];
+		FilterStats::Timer alloc(this->stats, FilterStats::PHASE_ALLOC);
+		Image<T> src_image = part_planes(src_views, src_copy, &src_view, 1, arena, ScratchArena::SLOT_SRC, this->layout);
+		alloc.stop();
+		{
+			FilterStats::Timer copy_in(this->stats, FilterStats::PHASE_COPY_IN);
+			this->stats.addPath(true, src_copy[0] ? import_planes(src_views[0], src_view, simd)
+				: FilterStats::PATH_ZERO_COPY);
+		}
 
-		if (src_stride_w != sizeof(T)) // not continuous elements, element-wise copy
+		// the first level is processed by this filter, which times it by itself,
+		// the filters of the other levels have their own stats, thus they are timed here
+		if (this->from_source) // each thread writes its levels through its own temp memory when required
 		{
-			for (ssize_t c = 0; c < channels; ++c)
+			ThreadPool &pool = ThreadPool::global();
+			pool.parallel_for(dst_views.size(), [&](size_t k)
 			{
-				for (ssize_t h = 0; h < src_height; ++h)
+				Image<U> dst_parts[1];
+				bool dst_copy[1];
+				Image<U> dst_image = part_planes(dst_parts, dst_copy, &dst_views[k], 1,
+					ScratchArena::local(), ScratchArena::SLOT_DST, this->layout);
+				if (k == 0)
 				{
-					const uint8_t *origin_ptr = static_cast<const uint8_t *>(src_buf.ptr)
-						+ c * src_stride_c + h * src_stride_h;
-					uint8_t *target_ptr = reinterpret_cast<uint8_t *>(src_image.getData())
-						+ (c * src_height + h) * src_image.getStride();
-
-					for (const uint8_t *origin_upper = origin_ptr + src_width * src_stride_w; origin_ptr < origin_upper;
-						origin_ptr += src_stride_w, target_ptr += sizeof(T))
-					{
-						*reinterpret_cast<T *>(target_ptr) = *reinterpret_cast<const T *>(origin_ptr);
-					}
+					Tbase::operator()(dst_image, src_image, true);
 				}
-			}
+				else
+				{
+					FilterStats::Timer timer(this->stats, FilterStats::PHASE_PROCESS);
+					this->level(k)(dst_image, src_image, true);
+				}
+				FilterStats::Timer copy_out(this->stats, FilterStats::PHASE_COPY_OUT);
+				this->stats.addPath(false, dst_copy[0] ? export_planes(dst_parts[0], dst_views[k], simd)
+					: FilterStats::PATH_ZERO_COPY);
+			}, threads ? threads : pool.size());
+			return;
 		}
-		else // continuous elements, not aligned data, copy with bitblt
+
+		// the 2x downscales of the chained levels are single graphs, which never use the slots of the intermediate images
+		Image<U> prev;
+		for (size_t k = 0; k < dst_views.size(); ++k)
 		{
-			for (ssize_t c = 0; c < channels; ++c)
+			Image<U> dst_parts[1];
+			bool dst_copy[1];
+			const int slot = k % 2 ? ScratchArena::SLOT_MID1 : ScratchArena::SLOT_MID0;
+			Image<U> dst_image = part_planes(dst_parts, dst_copy, &dst_views[k], 1, arena, slot, this->layout);
+			if (k == 0)
+			{
+				Tbase::operator()(dst_image, src_image);
+			}
+			else
 			{
-				const uint8_t *origin_ptr = static_cast<const uint8_t *>(src_buf.ptr)
-					+ c * src_stride_c;
-				uint8_t *target_ptr = reinterpret_cast<uint8_t *>(src_image.getData())
-					+ c * src_height * src_image.getStride();
+				FilterStats::Timer timer(this->stats, FilterStats::PHASE_PROCESS);
+				this->level(k)(dst_image, prev);
+			}
+			FilterStats::Timer copy_out(this->stats, FilterStats::PHASE_COPY_OUT);
+			this->stats.addPath(false, dst_copy[0] ? export_planes(dst_parts[0], dst_views[k], simd)
+				: FilterStats::PATH_ZERO_COPY);
+			prev = dst_image;
+		}
+	}
+
+	ZPyramidPy(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+};
+
+// pipelined processing of a sequence of frames of the same geometry, through rotating buffer sets
+// each frame goes through 3 stages: copy-in to aligned memory, processing by the graphs, and copy-out,
+// and with staged=true each stage has its own worker thread, so that the copy-in of the frame N+1,
+// the processing of the frame N and the copy-out of the frame N-1 overlap,
+// then the throughput is limited by the slowest stage instead of the sum of all of them
+// frames are pushed and popped in order, each one holding a buffer set until it is popped
+// the buffer sets keep their aligned memory from frame to frame, and parts used in place skip their copy
+// *** push and pop must be called from a single thread at a time ***
+class ZFrameProcessor
+	: public ZFilterPy
+{
+public:
+	typedef ZFrameProcessor Tthis;
+	typedef ZFilterPy Tbase;
 
-				bitblt(target_ptr, src_image.getStride(), origin_ptr,
-					src_stride_h, src_width * sizeof(T), src_height);
+	enum Stage
+	{
+		STAGE_COPY_IN = 0,
+		STAGE_PROCESS,
+		STAGE_COPY_OUT,
+		NUM_STAGES
+	};
+
+	// the graphs are rebuilt from the stages of the filter, with its layout and its number of bands
+	ZFrameProcessor(const ZFilterPy &filter, unsigned buffers = 3, bool staged = true)
+		: Tbase(filter.getStages(), false, false, false, filter.getBands())
+	{
+		if (buffers < 1)
+		{
+			throw std::runtime_error("A frame processor requires at least one buffer set");
+		}
+		this->setLayout(filter.getLayout());
+		for (unsigned k = 0; k < buffers; ++k)
+		{
+			this->slots.emplace_back(new Slot());
+		}
+		if (staged)
+		{
+			for (int k = 0; k < NUM_STAGES; ++k)
+			{
+				this->workers.emplace_back(&Tthis::worker_loop, this, k, k + 1);
 			}
 		}
+		else
+		{
+			this->workers.emplace_back(&Tthis::worker_loop, this, 0, static_cast<int>(NUM_STAGES));
+		}
+	}
 
-		// process
-		if (channels == 1)
+	// the frames still in flight are dropped, the current stages are completed first
+	~ZFrameProcessor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stop = true;
+		}
+		this->cond.notify_all();
+		for (std::thread &worker : this->workers)
+		{
+			worker.join();
+		}
+	}
+
+	unsigned getBuffers() const { return static_cast<unsigned>(this->slots.size()); }
+	bool isStaged() const { return this->workers.size() > 1; }
+
+	// number of frames pushed and not popped yet
+	unsigned getPending() const
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return static_cast<unsigned>(this->pushed - this->popped);
+	}
+
+	// queue a single image, checked and with its output allocated right away, as in ZFilter.submit()
+	// raise an error when every buffer set holds a frame, as only pop() can free one
+	void push(py::object src, bool channel_first, py::object out, bool convert)
+	{
+		if (this->getPending() >= this->slots.size())
+		{
+			throw std::runtime_error("Every buffer set holds a frame, pop one first");
+		}
+		this->visit_input(src, convert, [&](auto arr) { return this->push_to(arr, channel_first, out); });
+	}
+
+	// wait for the oldest frame, and return its result, the GIL is released while waiting
+	// the error raised while processing the frame, if any, is raised instead
+	py::array pop()
+	{
+		if (!this->getPending())
+		{
+			throw std::runtime_error("No frame to pop");
+		}
 		{
-			Tbase::operator()(dst_image, src_image);
+			py::gil_scoped_release release;
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->cond.wait(lock, [this]() { return this->done[NUM_STAGES - 1] > this->popped; });
 		}
-		else // channels == 3
+
+		Slot &slot = this->slot(this->popped);
+		py::array result = py::reinterpret_borrow<py::array>(slot.dst);
+		std::exception_ptr error = slot.error;
+		slot.reset();
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			++this->popped;
+		}
+		if (error) std::rethrow_exception(error);
+		return result;
+	}
+
+protected:
+	// a buffer set, with the stages of its current frame
+	// the arrays are only referenced and released with the GIL held, by push() and pop()
+	struct Slot
+	{
+		ScratchArena arena;
+		std::function<void()> stages[NUM_STAGES];
+		std::exception_ptr error;
+		py::object src;
+		py::object dst;
+
+		void reset()
+		{
+			for (auto &stage : this->stages) stage = nullptr;
+			this->error = nullptr;
+			this->src = py::object();
+			this->dst = py::object();
+		}
+	};
+
+	// planes of a frame, shared by its stages
+	template <typename T, typename U>
+	struct FrameImages
+	{
+		Image<T> src_views[1];
+		Image<U> dst_views[1];
+		bool src_copy[1];
+		bool dst_copy[1];
+		Image<T> src;
+		Image<U> dst;
+	};
+
+	std::vector<std::unique_ptr<Slot>> slots;
+	std::vector<std::thread> workers;
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+	uint64_t pushed = 0;
+	uint64_t popped = 0;
+	uint64_t done[NUM_STAGES] = {}; // number of frames through each stage
+	bool stop = false;
+
+	Slot &slot(uint64_t frame)
+	{
+		return *this->slots[frame % this->slots.size()];
+	}
+
+	template <typename T>
+	void push_to(PyArr<T> src_arr, bool channel_first, py::object &out)
+	{
+		if (!holds_pixels<T>(this->src_format.pixel_type))
 		{
-			const uint8_t *src_data = reinterpret_cast<const uint8_t *>(src_image.getData());
-			uint8_t *dst_data = reinterpret_cast<uint8_t *>(dst_image.getData());
+			throw std::runtime_error("Input data type must match the pixel type defined in the filter");
+		}
 
-			const ssize_t src_stride_h = src_image.getStride();
-			const ssize_t dst_stride_h = dst_image.getStride();
-			const ssize_t src_stride_c = src_height * src_stride_h;
-			const ssize_t dst_stride_c = dst_height * dst_stride_h;
+		// the output data type follows the pixel type of the target format
+		switch (this->dst_format.pixel_type)
+		{
+		case ZIMG_PIXEL_BYTE:
+			return this->push_frame<T, uint8_t>(src_arr, channel_first, out);
+		case ZIMG_PIXEL_WORD:
+			return this->push_frame<T, uint16_t>(src_arr, channel_first, out);
+		case ZIMG_PIXEL_HALF:
+			return this->push_frame<T, float16>(src_arr, channel_first, out);
+		case ZIMG_PIXEL_FLOAT:
+			return this->push_frame<T, float>(src_arr, channel_first, out);
+		default:
+			throw std::runtime_error("Unsupported output pixel type");
+		}
+	}
 
-			Tbase::operator()({ dst_data, dst_data + dst_stride_c, dst_data + 2 * dst_stride_c },
-				{ src_data, src_data + src_stride_c, src_data + 2 * src_stride_c },
-				{ dst_stride_h, dst_stride_h, dst_stride_h },
-				{ src_stride_h, src_stride_h, src_stride_h });
+	template <typename T, typename U>
+	void push_frame(PyArr<T> &src_arr, bool channel_first, py::object &out)
+	{
+		if (src_arr.ndim() > 3)
+		{
+			throw std::runtime_error("Frames must be single images");
 		}
+		FilterStats::Timer prepare(this->stats, FilterStats::PHASE_PREPARE);
+		PyArr<U> dst_arr = this->prepare_array<T, U>(src_arr, channel_first, out);
+		const ArrView src_view(src_arr.request(), channel_first);
+		const ArrView dst_view(dst_arr.request(true), channel_first);
+		prepare.stop();
+		this->stats.addCall(1, src_view.bytes(sizeof(T)), dst_view.bytes(sizeof(U)));
+
+		// the slot of the frame is free, as every earlier frame using it was popped
+		Slot &slot = this->slot(this->pushed);
+		slot.src = src_arr;
+		slot.dst = dst_arr;
+		const bool simd = this->params.cpu_type != ZIMG_CPU_NONE;
+		const auto images = std::make_shared<FrameImages<T, U>>();
+		ScratchArena *arena = &slot.arena;
+		slot.stages[STAGE_COPY_IN] = [this, images, arena, src_view, dst_view, simd]()
+		{
+			FrameImages<T, U> &frame = *images;
+			frame.src = part_planes(frame.src_views, frame.src_copy, &src_view, 1, *arena, ScratchArena::SLOT_SRC,
+				this->layout);
+			frame.dst = part_planes(frame.dst_views, frame.dst_copy, &dst_view, 1, *arena, ScratchArena::SLOT_DST,
+				this->layout);
+			FilterStats::Timer copy_in(this->stats, FilterStats::PHASE_COPY_IN);
+			this->stats.addPath(true, frame.src_copy[0] ? import_planes(frame.src_views[0], src_view, simd)
+				: FilterStats::PATH_ZERO_COPY);
+		};
+		// timed by ZFilter::process()
+		slot.stages[STAGE_PROCESS] = [this, images]()
+		{
+			ZFilter::operator()(images->dst, images->src, true);
+		};
+		slot.stages[STAGE_COPY_OUT] = [this, images, dst_view, simd]()
+		{
+			FrameImages<T, U> &frame = *images;
+			FilterStats::Timer copy_out(this->stats, FilterStats::PHASE_COPY_OUT);
+			this->stats.addPath(false, frame.dst_copy[0] ? export_planes(frame.dst_views[0], dst_view, simd)
+				: FilterStats::PATH_ZERO_COPY);
+		};
 
-		// copy dst data from aligned memory
-		const std::vector<ssize_t> dst_strides = dst_buf.strides;
-		const ssize_t dst_stride_c = ndim > 2 ? dst_strides[ndim - 3] : 0;
-		const ssize_t dst_stride_h = dst_strides[ndim - 2];
-		const ssize_t dst_stride_w = dst_strides[ndim - 1];
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			++this->pushed;
+		}
+		this->cond.notify_all();
+	}
 
-		if (dst_stride_w != sizeof(T)) // not continuous elements, element-wise copy
+	// run the stages [first, last) of the frames one after another
+	// the graphs use the temp memory of the worker thread, and the first error of a frame skips its following stages
+	// the workers follow the affinity of the thread pool, the stage k taking the CPUs of its worker k
+	void worker_loop(int first, int last)
+	{
+		ThreadPool::pin_current(first);
+		std::unique_lock<std::mutex> lock(this->mutex);
+		while (true)
 		{
-			for (ssize_t c = 0; c < channels; ++c)
+			this->cond.wait(lock, [&]()
+			{
+				return this->stop || this->done[first] < (first ? this->done[first - 1] : this->pushed);
+			});
+			if (this->stop)
+			{
+				return;
+			}
+			Slot &slot = this->slot(this->done[first]);
+			lock.unlock();
+			for (int k = first; k < last; ++k)
 			{
-				for (ssize_t h = 0; h < dst_height; ++h)
+				if (slot.error) break;
+				try
 				{
-					const uint8_t *origin_ptr = reinterpret_cast<const uint8_t *>(dst_image.getData())
-						+ (c * dst_height + h) * dst_image.getStride();
-					uint8_t *target_ptr = static_cast<uint8_t *>(dst_buf.ptr)
-						+ c * dst_stride_c + h * dst_stride_h;
-
-					for (const uint8_t *origin_upper = origin_ptr + dst_width * sizeof(T); origin_ptr < origin_upper;
-						origin_ptr += sizeof(T), target_ptr += dst_stride_w)
-					{
-						*reinterpret_cast<T *>(target_ptr) = *reinterpret_cast<const T *>(origin_ptr);
-					}
+					slot.stages[k]();
+				}
+				catch (...)
+				{
+					slot.error = std::current_exception();
 				}
 			}
-		}
-		else // continuous elements, not aligned data, copy with bitblt
-		{
-			for (ssize_t c = 0; c < channels; ++c)
+			lock.lock();
+			for (int k = first; k < last; ++k)
 			{
-				const uint8_t *origin_ptr = reinterpret_cast<const uint8_t *>(dst_image.getData())
-					+ c * dst_height * dst_image.getStride();
-				uint8_t *target_ptr = static_cast<uint8_t *>(dst_buf.ptr)
-					+ c * dst_stride_c;
-
-				bitblt(target_ptr, dst_stride_h, origin_ptr,
-					dst_image.getStride(), dst_width * sizeof(T), dst_height);
+				++this->done[k];
 			}
+			this->cond.notify_all();
 		}
-
-		// return array
-		return dst_arr;
 	}
 
-protected:
-	// disable copy constructor and copy assignment, as tmp_buf should not be shared
-	ZFilterPy(const Tthis &other) = delete;
+	ZFrameProcessor(const Tthis &other) = delete;
 	Tthis &operator=(const Tthis &other) = delete;
 };
 
+// constructors of the fixed filters, by pixel types, number of planes and layout
+struct FixedFactory
+{
+	zimg_pixel_type_e src_pixel;
+	zimg_pixel_type_e dst_pixel;
+	int planes;
+	bool interleaved;
+	std::function<py::object(const ZFilter::Zformat &, const ZFilter::Zformat &, const ZFilter::Zparams &, bool)> create;
+
+	static std::vector<FixedFactory> &registry()
+	{
+		static std::vector<FixedFactory> factories;
+		return factories;
+	}
+};
+
 ////////
 
 using namespace pybind11::literals;
 
+// serialize structs for pickling as raw memory, preceded by the zimg API version and the struct size,
+// thus only valid for the same build of the module, which is checked when loading
+template <typename T>
+static py::bytes dump_raw(const T *items, size_t count)
+{
+	const uint32_t header[2] = { ZIMG_API_VERSION, static_cast<uint32_t>(sizeof(T)) };
+	std::string data(reinterpret_cast<const char *>(header), sizeof(header));
+	data.append(reinterpret_cast<const char *>(items), sizeof(T) * count);
+	return py::bytes(data);
+}
+
+// at least one struct is expected, error is raised for another build of the module
+template <typename T>
+static std::vector<T> load_raw(const std::string &data, const char *error)
+{
+	const uint32_t header[2] = { ZIMG_API_VERSION, static_cast<uint32_t>(sizeof(T)) };
+	if (data.size() <= sizeof(header) || std::memcmp(data.data(), header, sizeof(header)) != 0
+		|| (data.size() - sizeof(header)) % sizeof(T) != 0)
+	{
+		throw std::runtime_error(error);
+	}
+	std::vector<T> items((data.size() - sizeof(header)) / sizeof(T));
+	std::memcpy(static_cast<void *>(items.data()), data.data() + sizeof(header), data.size() - sizeof(header));
+	return items;
+}
+
+// the stages of a filter, as the raw zimg structs
+static py::bytes dump_stages(const std::vector<ZFilter::Stage> &stages)
+{
+	return dump_raw(stages.data(), stages.size());
+}
+
+static std::vector<ZFilter::Stage> load_stages(const std::string &data)
+{
+	return load_raw<ZFilter::Stage>(data, "Pickled ZFilter was created by another version of the module");
+}
+
+// the layout is pickled along the stages, as (alignment, padded)
+static py::tuple dump_layout(const PlaneLayout &layout)
+{
+	return py::make_tuple(layout.alignment, layout.padded);
+}
+
+static PlaneLayout load_layout(py::tuple state)
+{
+	PlaneLayout layout;
+	layout.alignment = state[0].cast<size_t>();
+	layout.padded = state[1].cast<bool>();
+	return layout;
+}
+
+// change the layout from Python, refused for concurrent filters,
+// which may be processing in other threads, and are shared by the caches
+static void set_layout(ZFilterPy &self, const PlaneLayout &layout)
+{
+	if (self.isConcurrent())
+	{
+		throw std::runtime_error("The layout of a concurrent ZFilter can't be changed, as it may be in use");
+	}
+	self.setLayout(layout);
+}
+
+// bind a fixed filter as a subclass of ZFilter, and register its constructor for fixed_filter()
+template <typename T, typename U, int C, bool Interleaved>
+static void bind_fixed(py::module &m, const char *name)
+{
+	typedef ZFilterFixed<T, U, C, Interleaved> Tfixed;
+	typedef zimgxx::zfilter_graph_builder_params ZGraphParams;
+	py::class_<Tfixed, ZFilterPy, std::shared_ptr<Tfixed>>(m, name,
+		"ZFilter specialized at compile time for the pixel types, number of planes and layout in its name. "
+		"Calling it processes a single C-contiguous image, (height, width) for a single plane, "
+		"(channels, height, width) for chw, or (height, width, channels) for hwc, of its element type. "
+		"Any other call, with other arrays or the arguments of ZFilter.__call__, goes to the generic overloads.")
+		.def(py::init<const ZFilter::Zformat &, const ZFilter::Zformat &, const ZGraphParams &, bool>(),
+			"src_format"_a, "dst_format"_a, "params"_a, "concurrent"_a=false)
+		// the fixed overload takes its own element type in place, any other call goes to the overloads of ZFilter,
+		// which are bound again as the ones of a subclass would replace them otherwise
+		.def("__call__", &Tfixed::__call__, "Process a single image", "src"_a.noconvert())
+		.def("__call__", &ZFilterPy::__call__<uint8_t>, "Process uint8 array input",
+			"src"_a.noconvert(), "channel_first"_a=true, "threads"_a=1, "out"_a=py::none())
+		.def("__call__", &ZFilterPy::__call__<uint16_t>, "Process uint16 array input",
+			"src"_a.noconvert(), "channel_first"_a=true, "threads"_a=1, "out"_a=py::none())
+		.def("__call__", &ZFilterPy::__call__<float>, "Process float32 array input",
+			"src"_a.noconvert(), "channel_first"_a=true, "threads"_a=1, "out"_a=py::none())
+		.def("__call__", &ZFilterPy::__call__<float16>, "Process float16 array input, for the HALF pixel type",
+			"src"_a.noconvert(), "channel_first"_a=true, "threads"_a=1, "out"_a=py::none())
+		.def("__call__", &ZFilterPy::call_any, "Process any other input, as ZFilter.__call__",
+			"src"_a, "channel_first"_a=true, "threads"_a=1, "out"_a=py::none(), "convert"_a=false)
+		.def(py::pickle(
+			[](const Tfixed &self)
+			{
+				return py::make_tuple(dump_stages(self.getStages()), self.isConcurrent(), dump_layout(self.getLayout()));
+			},
+			[](py::tuple state)
+			{
+				const ZFilter::Stage stage = load_stages(state[0].cast<std::string>()).front();
+				auto filter = std::make_shared<Tfixed>(stage.src_format, stage.dst_format, stage.params, state[1].cast<bool>());
+				filter->setLayout(load_layout(state[2].cast<py::tuple>()));
+				return filter;
+			}));
+
+	FixedFactory factory;
+	factory.src_pixel = pixel_type_of<T>();
+	factory.dst_pixel = pixel_type_of<U>();
+	factory.planes = C;
+	factory.interleaved = Interleaved;
+	factory.create = [](const ZFilter::Zformat &src_format, const ZFilter::Zformat &dst_format,
+		const ZFilter::Zparams &params, bool concurrent)
+	{
+		return py::cast(std::make_shared<Tfixed>(src_format, dst_format, params, concurrent));
+	};
+	FixedFactory::registry().push_back(factory);
+}
+
+// bind the fixed filters of a pair of pixel types, for 1, 3 and 4 planes
+template <typename T, typename U>
+static void bind_fixed_layouts(py::module &m, const std::string &types)
+{
+	bind_fixed<T, U, 1, false>(m, ("ZFilter_" + types + "_c1").c_str());
+	bind_fixed<T, U, 3, false>(m, ("ZFilter_" + types + "_c3_chw").c_str());
+	bind_fixed<T, U, 3, true>(m, ("ZFilter_" + types + "_c3_hwc").c_str());
+	bind_fixed<T, U, 4, false>(m, ("ZFilter_" + types + "_c4_chw").c_str());
+	bind_fixed<T, U, 4, true>(m, ("ZFilter_" + types + "_c4_hwc").c_str());
+}
+
 PYBIND11_MODULE(zimg, m)
 {
 	m.doc() = "Zimg: a plugin for colorspace conversion";
@@ -205,6 +2595,12 @@ PYBIND11_MODULE(zimg, m)
 		.value("GREY", ZIMG_COLOR_GREY)
 		.value("RGB", ZIMG_COLOR_RGB)
 		.value("YUV", ZIMG_COLOR_YUV);
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+	py::enum_<zimg_alpha_type_e>(m, "Alpha")
+		.value("NONE", ZIMG_ALPHA_NONE)
+		.value("STRAIGHT", ZIMG_ALPHA_STRAIGHT)
+		.value("PREMULTIPLIED", ZIMG_ALPHA_PREMULTIPLIED);
+#endif
 	py::enum_<zimg_field_parity_e>(m, "Field")
 		.value("PROGRESSIVE", ZIMG_FIELD_PROGRESSIVE)
 		.value("TOP", ZIMG_FIELD_TOP)
@@ -297,6 +2693,9 @@ PYBIND11_MODULE(zimg, m)
 		.def_readwrite("field_parity", &Zformat::field_parity)
 		.def_readwrite("chroma_location", &Zformat::chroma_location)
 		.def_readwrite("active_region", &Zformat::active_region)
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+		.def_readwrite("alpha", &Zformat::alpha)
+#endif
 		;
 	// ZGraphParams
 	typedef zimgxx::zfilter_graph_builder_params ZGraphParams;
@@ -323,27 +2722,565 @@ PYBIND11_MODULE(zimg, m)
 		.def_readwrite("color_family", &ZResizeParams::color_family)
 		.def_readwrite("depth", &ZResizeParams::depth)
 		.def_readwrite("pixel_range", &ZResizeParams::pixel_range)
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+		.def_readwrite("alpha", &ZResizeParams::alpha)
+#endif
 		.def_readwrite("filter", &ZResizeParams::filter)
 		.def_readwrite("filter_a", &ZResizeParams::filter_a)
 		.def_readwrite("filter_b", &ZResizeParams::filter_b)
 		.def_readwrite("dither_type", &ZResizeParams::dither_type)
 		.def_readwrite("cpu_type", &ZResizeParams::cpu_type)
+		.def_readwrite("prereduce", &ZResizeParams::prereduce,
+			"Maximum factor (2 or 4) of an area average of the source run before the resize graph "
+			"for downscales of at least twice this factor, 0 or 1 disables it. "
+			"The output is slightly softer than with the single graph, thus not bit-exact. "
+			"Straight alpha keeps the single graph. A filter running an area average is a pipeline, "
+			"which keeps a single band, thus bands != 1 has no effect then")
+		;
+	// ZFuture
+	py::class_<ZFuture> zfuture(m, "ZFuture",
+		"Pending result of ZFilter.submit(). The task is completed by a worker thread of the pool "
+		"without taking the GIL. Destroying the future waits for the task to complete.");
+	zfuture
+		.def("done", &ZFuture::done, "Return True if the task has completed")
+		.def("wait", [](const ZFuture &self, py::object timeout)
+			{
+				const double seconds = timeout.is_none() ? -1 : timeout.cast<double>();
+				py::gil_scoped_release release;
+				return self.wait(seconds);
+			},
+			"Wait for the task to complete, return False if the timeout in seconds expired first",
+			"timeout"_a=py::none())
+		.def("result", [](const ZFuture &self, py::object timeout)
+			{
+				return self.result(timeout.is_none() ? -1 : timeout.cast<double>());
+			},
+			"Wait for the task to complete and return the target array, "
+			"or raise the exception it failed with, TimeoutError is raised if the timeout in seconds expires",
+			"timeout"_a=py::none())
+		;
+	// memory-mapped frame files
+	py::class_<FrameReader>(m, "FrameReader",
+		"Sequence of frames read in place from a memory-mapped file, a y4m stream (recognized by its header) "
+		"or raw frames with the planes one after another (I420 layout), described by format. "
+		"A background thread reads ahead the next readahead frames (0 disables it), "
+		"so that the I/O overlaps with the processing.")
+		.def(py::init<const std::string &, const Zformat *, unsigned>(),
+			"path"_a, "format"_a=py::none(), "readahead"_a=2)
+		.def_property_readonly("format", &FrameReader::getFormat,
+			"Geometry of the frames, the color properties of a y4m stream are left unspecified")
+		.def_property_readonly("y4m", &FrameReader::isY4m)
+		.def_property_readonly("y4m_params", &FrameReader::getParams,
+			"Tags of the y4m header other than the geometry, such as the frame rate")
+		.def_property_readonly("count", &FrameReader::getCount)
+		.def_property_readonly("frame_size", &FrameReader::getFrameSize, "Size of a frame in bytes")
+		.def("__len__", &FrameReader::getCount)
+		.def("read", [](py::object self, size_t k)
+			{
+				FrameReader &reader = self.cast<FrameReader &>();
+				const Zformat &format = reader.getFormat();
+				const size_t elem = pixel_size(format.pixel_type);
+				const char *dtype = format.pixel_type == ZIMG_PIXEL_FLOAT ? "float32"
+					: format.pixel_type == ZIMG_PIXEL_HALF ? "float16"
+					: format.pixel_type == ZIMG_PIXEL_WORD ? "uint16" : "uint8";
+				py::array arr(py::dtype(dtype), std::vector<ssize_t>{ static_cast<ssize_t>(reader.getFrameSize() / elem) },
+					std::vector<ssize_t>{ static_cast<ssize_t>(elem) }, reader.frame(k), self);
+				arr.attr("setflags")("write"_a=false);
+				return arr;
+			},
+			"Get a read-only 1-D array of the frame k, sharing the mapped memory", "k"_a)
+		;
+	py::class_<FrameWriter>(m, "FrameWriter",
+		"Sequence of frames appended in place into a memory-mapped file, a y4m stream with y4m=True "
+		"or raw frames with the planes one after another (I420 layout). "
+		"The file grows by chunks of frames, and is truncated to the written frames when closed.")
+		.def(py::init<const std::string &, const Zformat &, bool, const std::string &>(),
+			"path"_a, "format"_a, "y4m"_a=false, "y4m_params"_a="")
+		.def_property_readonly("format", &FrameWriter::getFormat)
+		.def_property_readonly("y4m", &FrameWriter::isY4m)
+		.def_property_readonly("count", &FrameWriter::getCount)
+		.def_property_readonly("frame_size", &FrameWriter::getFrameSize, "Size of a frame in bytes")
+		.def("__len__", &FrameWriter::getCount)
+		.def("write", [](FrameWriter &self, py::object frame)
+			{
+				const py::array arr = py::array::ensure(frame, py::array::c_style);
+				if (!arr || static_cast<size_t>(arr.nbytes()) != self.getFrameSize())
+				{
+					throw std::runtime_error("Frame must be an array of the size of a frame in bytes");
+				}
+				std::memcpy(self.append(), arr.data(), self.getFrameSize());
+			},
+			"Append a frame copied from an array holding frame_size bytes", "frame"_a)
+		.def("close", &FrameWriter::close, "Truncate the file to the written frames and unmap it")
+		.def("__enter__", [](py::object self) { return self; })
+		.def("__exit__", [](FrameWriter &self, py::args) { self.close(); })
 		;
 	// ZFilter
-	py::class_<ZFilterPy> zfilter(m, "ZFilter");
+	py::class_<ZFilterPy, std::shared_ptr<ZFilterPy>> zfilter(m, "ZFilter",
+		"The GIL is released while processing, so different ZFilter instances can run in parallel "
+		"from multiple threads. A single instance owns one temporary buffer and must not be called "
+		"from multiple threads at the same time, unless it is created with concurrent=True "
+		"(as the cached ones are), which uses a temporary buffer per thread instead.\n"
+		"With bands != 1 (0 means one per thread of the pool), a single image is split into row bands "
+		"processed in parallel, with bit-exact output. The bands attribute tells how many were actually "
+		"formed, as configurations where rows can't be processed independently keep a single band, "
+		"and so do pipelines, including resizers whose prereduce runs an area average.\n"
+		"With autotune=True, the cpu type of each graph is the fastest one measured on this CPU, "
+		"taken from the table of autotune_file() when the configuration was already measured.");
 	zfilter
 		// constructors
-		.def(py::init<const Zformat &, const Zformat &, const ZGraphParams &>(),
-			"src_format"_a, "dst_format"_a, "params"_a)
+		.def(py::init<const Zformat &, const Zformat &, const ZGraphParams &, bool, unsigned, bool>(),
+			"src_format"_a, "dst_format"_a, "params"_a, "concurrent"_a=false, "bands"_a=1, "autotune"_a=false)
 		.def(py::init<const ZResizeParams &,
 			unsigned, unsigned, unsigned, unsigned,
-			double, double, double, double>(),
+			double, double, double, double, bool, unsigned, bool>(),
 			"params"_a,
 			"src_width"_a, "src_height"_a, "dst_width"_a, "dst_height"_a,
-			"roi_left"_a=0, "roi_top"_a=0, "roi_width"_a=0, "roi_height"_a=0)
+			"roi_left"_a=0, "roi_top"_a=0, "roi_width"_a=0, "roi_height"_a=0,
+			"concurrent"_a=false, "bands"_a=1, "autotune"_a=false)
+		.def(py::init([](py::sequence filters, bool reorder, bool fuse, bool concurrent, unsigned bands, bool autotune)
+			{
+				std::vector<ZFilterPy::Stage> stages;
+				for (size_t k = 0; k < filters.size(); ++k)
+				{
+					for (const ZFilterPy::Stage &stage : filters[k].cast<const ZFilterPy &>().getStages())
+					{
+						stages.push_back(stage);
+					}
+				}
+				return std::make_shared<ZFilterPy>(stages, reorder, fuse, concurrent, bands, autotune);
+			}),
+			"Create a pipeline running the stages of a sequence of ZFilter as a single filter, "
+			"with the intermediate images kept in temporary memory. "
+			"A pure resize takes the format of the image it receives. "
+			"With reorder=True, a pure resize is moved before a conversion when downscaling, "
+			"and after it when upscaling, so that the conversion runs on the smaller image, "
+			"unless the conversion changes the transfer or primaries. "
+			"With fuse=True, adjacent stages with the same params are merged into a single graph "
+			"when one of them keeps the dimensions. Reordered or fused stages are not bit-exact "
+			"with running the stages one by one.",
+			"stages"_a, "reorder"_a=true, "fuse"_a=true, "concurrent"_a=false, "bands"_a=1, "autotune"_a=false)
+		// pickling rebuilds the graphs from the formats and params, as planned when the filter was created
+		.def(py::pickle(
+			[](const ZFilterPy &self)
+			{
+				return py::make_tuple(dump_stages(self.getStages()), self.isConcurrent(), self.getBands(),
+					dump_layout(self.getLayout()));
+			},
+			[](py::tuple state)
+			{
+				auto filter = std::make_shared<ZFilterPy>(load_stages(state[0].cast<std::string>()), false, false,
+					state[1].cast<bool>(), state[2].cast<unsigned>());
+				filter->setLayout(load_layout(state[3].cast<py::tuple>()));
+				return filter;
+			}))
+		// attributes
+		.def_property_readonly("src_format", &ZFilterPy::getSrcFormat)
+		.def_property_readonly("dst_format", &ZFilterPy::getDstFormat)
+		.def_property_readonly("params", &ZFilterPy::getParams)
+		.def_property_readonly("concurrent", &ZFilterPy::isConcurrent)
+		.def_property_readonly("bands", &ZFilterPy::getBands)
+		.def_property("alignment",
+			[](const ZFilterPy &self) { return self.getLayout().alignment; },
+			[](ZFilterPy &self, size_t alignment)
+			{
+				PlaneLayout layout = self.getLayout();
+				layout.alignment = alignment;
+				set_layout(self, layout);
+			},
+			"Alignment in bytes of the planes and temporary memory allocated for the graphs, "
+			"64 with the AUTO_64B cpu type and 32 otherwise by default, a power of 2 of at least 32. "
+			"Arrays with another alignment are copied through aligned temporary memory. "
+			"It can't be changed on a concurrent filter, including the cached ones")
+		.def_property("padded_strides",
+			[](const ZFilterPy &self) { return self.getLayout().padded; },
+			[](ZFilterPy &self, bool padded)
+			{
+				PlaneLayout layout = self.getLayout();
+				layout.padded = padded;
+				set_layout(self, layout);
+			},
+			"Whether the row pitches of the planes allocated for the graphs (temporary memory and planar results) "
+			"are padded beyond the alignment when they are multiples of 1024 bytes, "
+			"whose rows share the same cache sets in vertical passes, False by default. "
+			"It can't be changed on a concurrent filter, including the cached ones")
+		.def_property("stats_enabled",
+			[](const ZFilterPy &self) { return self.getStats().isEnabled(); },
+			[](ZFilterPy &self, bool enabled) { self.getStats().setEnabled(enabled); },
+			"Whether the calls are counted by stats(), disabled by default")
+		.def("stats", [](const ZFilterPy &self)
+			{
+				const FilterStats::Snapshot stats = self.getStats().getSnapshot();
+				py::dict result;
+				result["calls"] = stats.calls;
+				result["images"] = stats.images;
+				result["bytes_in"] = stats.bytes_in;
+				result["bytes_out"] = stats.bytes_out;
+				py::dict time_ns;
+				for (int i = 0; i < FilterStats::NUM_PHASES; ++i)
+				{
+					time_ns[FilterStats::phase_name(i)] = stats.nanoseconds[i];
+				}
+				result["time_ns"] = time_ns;
+				py::dict paths_in;
+				py::dict paths_out;
+				for (int i = 0; i < FilterStats::NUM_PATHS; ++i)
+				{
+					paths_in[FilterStats::path_name(i)] = stats.paths_in[i];
+					paths_out[FilterStats::path_name(i)] = stats.paths_out[i];
+				}
+				result["copy_in"] = paths_in;
+				result["copy_out"] = paths_out;
+				return result;
+			},
+			"Get the counters of the calls made while stats_enabled is True: calls, images, bytes_in, bytes_out, "
+			"time_ns per phase (prepare, alloc, copy_in, process, copy_out), summed over the threads, "
+			"and copy_in/copy_out counting the parts of the images passed in place (zero_copy), "
+			"by rows (bitblt), by (de)interleaving channels (interleave), with a fixed step of 2 to 4 elements (strided), "
+			"or element by element (elementwise)")
+		.def("reset_stats", [](const ZFilterPy &self) { self.getStats().reset(); },
+			"Reset the counters of stats()")
+		.def_property_readonly("stages", [](const ZFilterPy &self)
+			{
+				py::list result;
+				for (const ZFilterPy::Stage &stage : self.getStages())
+				{
+					result.append(py::make_tuple(stage.src_format, stage.dst_format, stage.params, stage.box));
+				}
+				return result;
+			},
+			"List of the (src_format, dst_format, params, box) of the stages run one after another, "
+			"box > 1 is an area average of box x box blocks instead of a graph")
 		// process
-		.def("__call__", &ZFilterPy::__call__<uint8_t>, "Process uint8 array input")
-		.def("__call__", &ZFilterPy::__call__<uint16_t>, "Process uint16 array input")
-		.def("__call__", &ZFilterPy::__call__<float>, "Process float32 array input")
+		// the typed overloads only take NumPy arrays of their element type, without any conversion,
+		// everything else goes to the last overload, which never copies silently
+		.def("__call__", &ZFilterPy::__call__<uint8_t>, "Process uint8 array input",
+			"src"_a.noconvert(), "channel_first"_a=true, "threads"_a=1, "out"_a=py::none())
+		.def("__call__", &ZFilterPy::__call__<uint16_t>, "Process uint16 array input",
+			"src"_a.noconvert(), "channel_first"_a=true, "threads"_a=1, "out"_a=py::none())
+		.def("__call__", &ZFilterPy::__call__<float>, "Process float32 array input",
+			"src"_a.noconvert(), "channel_first"_a=true, "threads"_a=1, "out"_a=py::none())
+		.def("__call__", &ZFilterPy::__call__<float16>, "Process float16 array input, for the HALF pixel type",
+			"src"_a.noconvert(), "channel_first"_a=true, "threads"_a=1, "out"_a=py::none())
+		.def("__call__", &ZFilterPy::call_any,
+			"Process any other input: DLPack producers (__dlpack__, such as CPU tensors) "
+			"and buffer protocol objects are used in place when they hold the pixel type of the filter, "
+			"anything requiring a copy (other types, data types or objects) raises TypeError, "
+			"unless convert=True. The result is a NumPy array, which can be exported through DLPack "
+			"without a copy, and out may also be a writeable DLPack producer or buffer",
+			"src"_a, "channel_first"_a=true, "threads"_a=1, "out"_a=py::none(), "convert"_a=false)
+		.def("submit", &ZFilterPy::submit<uint8_t>,
+			"Queue uint8 array input to be processed by the thread pool, return a ZFuture of the result",
+			"src"_a.noconvert(), "channel_first"_a=true, "out"_a=py::none(), "notify_fd"_a=-1)
+		.def("submit", &ZFilterPy::submit<uint16_t>,
+			"Queue uint16 array input to be processed by the thread pool, return a ZFuture of the result",
+			"src"_a.noconvert(), "channel_first"_a=true, "out"_a=py::none(), "notify_fd"_a=-1)
+		.def("submit", &ZFilterPy::submit<float>,
+			"Queue float32 array input to be processed by the thread pool, return a ZFuture of the result",
+			"src"_a.noconvert(), "channel_first"_a=true, "out"_a=py::none(), "notify_fd"_a=-1)
+		.def("submit", &ZFilterPy::submit<float16>,
+			"Queue float16 array input to be processed by the thread pool, return a ZFuture of the result",
+			"src"_a.noconvert(), "channel_first"_a=true, "out"_a=py::none(), "notify_fd"_a=-1)
+		.def("submit", &ZFilterPy::submit_any,
+			"Queue any other input to be processed by the thread pool, as taken by __call__, "
+			"return a ZFuture of the result",
+			"src"_a, "channel_first"_a=true, "out"_a=py::none(), "notify_fd"_a=-1, "convert"_a=false)
+		.def("stream", &ZFilterPy::stream,
+			"Process row by row through callables, so that neither image has to be entirely in memory.\n"
+			"reader(i) returns the source row i, and writer(i, left, row) receives the columns "
+			"[left, left + width) of the target row i. A row is a (width,) array for a single channel, "
+			"(channels, width) with channel_first=True, or (width, channels) otherwise. "
+			"Source rows must be NumPy arrays of the pixel type of the filter, TypeError is raised otherwise. "
+			"Source rows may be read again, and target rows written in several parts, "
+			"when the image is processed in column tiles.",
+			"reader"_a, "writer"_a, "channel_first"_a=true)
+		.def("planes", &ZFilterPy::planes,
+			"Process an image given as a sequence of 2-D arrays, one per plane, "
+			"with the chroma planes sized after the subsampling. Return the list of the target planes. "
+			"Planes requiring a copy raise TypeError unless convert=True, as for __call__.",
+			"src"_a, "convert"_a=false)
+		.def("packed", &ZFilterPy::packed,
+			"Process an image stored in a single continuous buffer, with the planes one after another (I420), "
+			"or with semi_planar=True, the chroma planes interleaved in a single plane (NV12). "
+			"The target is stored in the same layout. "
+			"An input requiring a copy, including a non C-contiguous one, raises TypeError unless convert=True.",
+			"src"_a, "semi_planar"_a=false, "convert"_a=false)
+		.def("crops", &ZFilterPy::crops,
+			"Resize several regions of a single image to the target size in one call. "
+			"rois is a sequence of (left, top, width, height) in source pixels, replacing the active region. "
+			"Return a batch of every crop, NCHW with channel_first=True and NHWC otherwise. "
+			"The source is copied at most once, crops of the same size and alignment share a graph, "
+			"and threads != 1 spreads the crops across the thread pool (0 means all the threads).",
+			"src"_a, "rois"_a, "channel_first"_a=true, "threads"_a=1, "out"_a=py::none(), "convert"_a=false)
+		.def("tiled", &ZFilterPy::tiled,
+			"Process a single image in tiles of the target, so that each tile only needs its window of the source, "
+			"derived from the filter support. The result matches processing the whole image, "
+			"up to the rounding of the filter positions when resizing. "
+			"Memory-mapped arrays (numpy.memmap) can be used for both src and out, "
+			"and threads != 1 spreads the tiles across the thread pool (0 means all the threads).",
+			"src"_a, "tile_width"_a=512, "tile_height"_a=512, "channel_first"_a=true, "threads"_a=1,
+			"out"_a=py::none(), "convert"_a=false)
+		.def("frames", &ZFilterPy::frames,
+			"Convert the frames [first, first + count) of a FrameReader, appending them to a FrameWriter, "
+			"count=0 means all the following frames. The planes are read and written in place in the mapped files "
+			"when aligned. The GIL is released for the whole sequence. Return the number of frames converted.",
+			"reader"_a, "writer"_a, "first"_a=0, "count"_a=0)
 		;
+	////////
+	// fixed filters
+	bind_fixed_layouts<uint8_t, uint8_t>(m, "u8_u8");
+	bind_fixed_layouts<uint16_t, uint16_t>(m, "u16_u16");
+	bind_fixed_layouts<float, float>(m, "f32_f32");
+	bind_fixed_layouts<uint16_t, uint8_t>(m, "u16_u8");
+	bind_fixed_layouts<uint8_t, float>(m, "u8_f32");
+	bind_fixed_layouts<float, uint8_t>(m, "f32_u8");
+	m.def("fixed_filter", [](const Zformat &src_format, const Zformat &dst_format, const ZGraphParams &params,
+		bool interleaved, bool concurrent)
+		{
+			const int planes = plane_count(src_format);
+			for (const FixedFactory &factory : FixedFactory::registry())
+			{
+				if (factory.src_pixel == src_format.pixel_type && factory.dst_pixel == dst_format.pixel_type
+					&& factory.planes == planes && (factory.interleaved == interleaved || planes == 1))
+				{
+					return factory.create(src_format, dst_format, params, concurrent);
+				}
+			}
+			throw std::runtime_error("No fixed filter for these pixel types, number of planes and layout");
+		},
+		"Create the ZFilter specialized for the pixel types and number of planes of the formats, "
+		"taking (channels, height, width) images, or (height, width, channels) with interleaved=True",
+		"src_format"_a, "dst_format"_a, "params"_a, "interleaved"_a=false, "concurrent"_a=false);
+	////////
+	// pyramid
+	py::class_<ZPyramidPy, ZFilterPy, std::shared_ptr<ZPyramidPy>>(m, "ZPyramid",
+		"Image pyramid, each level halves the dimensions of the previous one, rounded up. "
+		"Calling it returns the list of the levels, starting at half the source size. "
+		"Each level is resized from the previous one without leaving the native memory, "
+		"or from the source with from_source=True, which is sharper and lets threads != 1 "
+		"spread the levels across the thread pool (0 means all the threads). "
+		"The methods inherited from ZFilter only process the first level.")
+		.def(py::init<const ZResizeParams &, unsigned, unsigned, unsigned, bool, bool>(),
+			"params"_a, "width"_a, "height"_a, "levels"_a, "from_source"_a=false, "concurrent"_a=false)
+		.def("__call__", &ZPyramidPy::__call__,
+			"Process a single image, HW, CHW with channel_first=True or HWC otherwise. "
+			"An input requiring a copy raises TypeError unless convert=True, as for ZFilter.",
+			"src"_a, "channel_first"_a=true, "threads"_a=1, "convert"_a=false)
+		.def_property_readonly("levels", &ZPyramidPy::getLevels)
+		.def_property_readonly("from_source", &ZPyramidPy::isFromSource)
+		.def_property_readonly("sizes", [](const ZPyramidPy &self)
+			{
+				py::list result;
+				for (unsigned k = 1; k <= self.getLevels(); ++k)
+				{
+					result.append(py::make_tuple(ZPyramidPy::level_size(self.getSrcFormat().width, k),
+						ZPyramidPy::level_size(self.getSrcFormat().height, k)));
+				}
+				return result;
+			},
+			"List of the (width, height) of the levels")
+		// the resize params are stored raw, with the same header as the stages of ZFilter
+		.def(py::pickle(
+			[](const ZPyramidPy &self)
+			{
+				return py::make_tuple(dump_raw(&self.getResizeParams(), 1),
+					self.getSrcFormat().width, self.getSrcFormat().height, self.getLevels(),
+					self.isFromSource(), self.isConcurrent());
+			},
+			[](py::tuple state)
+			{
+				const std::vector<ZResizeParams> raw = load_raw<ZResizeParams>(state[0].cast<std::string>(),
+					"Pickled ZPyramid was created by another version of the module");
+				if (raw.size() != 1)
+				{
+					throw std::runtime_error("Pickled ZPyramid was created by another version of the module");
+				}
+				const ZResizeParams &params = raw.front();
+				return std::make_shared<ZPyramidPy>(params, state[1].cast<unsigned>(), state[2].cast<unsigned>(),
+					state[3].cast<unsigned>(), state[4].cast<bool>(), state[5].cast<bool>());
+			}));
+	py::class_<ZFrameProcessor, std::shared_ptr<ZFrameProcessor>>(m, "ZFrameProcessor",
+		"Pipelined processing of a sequence of frames through the graphs of a filter, "
+		"with its layout and bands, so that the processing of a banded filter runs on the thread pool. "
+		"Each frame holds one of the rotating aligned buffer sets from push() to pop(), "
+		"and with staged=True its copy-in, processing and copy-out run on 3 worker threads, "
+		"overlapping with the other frames in flight, otherwise a single worker thread runs them in turn. "
+		"Frames are popped in the order they were pushed, push() and pop() are not thread-safe.")
+		.def(py::init<const ZFilterPy &, unsigned, bool>(),
+			"filter"_a, "buffers"_a=3, "staged"_a=true)
+		.def("push", &ZFrameProcessor::push,
+			"Queue a single image, HW, CHW with channel_first=True or HWC otherwise, "
+			"its result is written into out when provided. Raise an error when every buffer set is in use. "
+			"An input requiring a copy raises TypeError unless convert=True, as for ZFilter.",
+			"src"_a, "channel_first"_a=true, "out"_a=py::none(), "convert"_a=false)
+		.def("pop", &ZFrameProcessor::pop,
+			"Wait for the oldest frame pushed, and return its result, "
+			"or raise the error raised while processing it")
+		.def_property_readonly("pending", &ZFrameProcessor::getPending,
+			"Number of frames pushed and not popped yet")
+		.def_property_readonly("buffers", &ZFrameProcessor::getBuffers)
+		.def_property_readonly("staged", &ZFrameProcessor::isStaged)
+		.def_property_readonly("src_format", &ZFrameProcessor::getSrcFormat)
+		.def_property_readonly("dst_format", &ZFrameProcessor::getDstFormat);
+	////////
+	// interoperability
+	m.def("array_view", [](py::object obj)
+		{
+			const py::object view = array_view(obj);
+			return view ? view : py::object(py::none());
+		},
+		"Get a NumPy array sharing the memory of an array, a DLPack producer (__dlpack__) or a buffer protocol object, "
+		"or None when the memory can't be shared",
+		"obj"_a);
+	////////
+	// process-wide filter cache
+	typedef FilterCache<ZFilterPy> ZCache;
+	// the tuned cpu type is part of the key, so that tuned and untuned filters are cached apart
+	m.def("cache_filter", [](const Zformat &src_format, const Zformat &dst_format, const ZGraphParams &params,
+		bool autotune)
+		{
+			return ZCache::global().get(src_format, dst_format,
+				autotune ? ZFilterPy::tuned(src_format, dst_format, params) : params);
+		},
+		"Get a cached concurrent ZFilter, which is built on the first request, "
+		"autotune=True takes the fastest cpu type on this CPU as ZFilter does",
+		"src_format"_a, "dst_format"_a, "params"_a, "autotune"_a=false);
+	m.def("cache_resizer", [](const ZResizeParams &params,
+		unsigned src_width, unsigned src_height, unsigned dst_width, unsigned dst_height,
+		double roi_left, double roi_top, double roi_width, double roi_height, bool autotune)
+		{
+			return ZCache::global().get(autotune ? ZFilterPy::tune_cpu(params, src_width, src_height,
+					dst_width, dst_height, roi_left, roi_top, roi_width, roi_height) : params,
+				src_width, src_height, dst_width, dst_height,
+				roi_left, roi_top, roi_width, roi_height);
+		},
+		"Get a cached concurrent ZFilter for resizing, which is built on the first request, "
+		"autotune=True takes the fastest cpu type on this CPU as ZFilter does",
+		"params"_a,
+		"src_width"_a, "src_height"_a, "dst_width"_a, "dst_height"_a,
+		"roi_left"_a=0, "roi_top"_a=0, "roi_width"_a=0, "roi_height"_a=0, "autotune"_a=false);
+	m.def("cache_set_capacity", [](size_t capacity) { ZCache::global().setCapacity(capacity); },
+		"Set the maximum number of cached filters, 0 disables caching", "capacity"_a);
+	m.def("cache_stats", []()
+		{
+			const ZCache::Stats stats = ZCache::global().getStats();
+			py::dict result;
+			result["hits"] = stats.hits;
+			result["misses"] = stats.misses;
+			result["evictions"] = stats.evictions;
+			result["size"] = stats.size;
+			result["capacity"] = stats.capacity;
+			return result;
+		},
+		"Get the counters of the filter cache");
+	m.def("cache_reset_stats", []() { ZCache::global().resetStats(); },
+		"Reset the counters of the filter cache");
+	m.def("cache_clear", []() { ZCache::global().clear(); },
+		"Remove all the cached filters");
+	////////
+	// cpu type autotuning, see CpuTuner
+	m.def("autotune_file", []() { return CpuTuner::global().getPath(); },
+		"Get the file of the table of the measured cpu types, "
+		"$ZIMG_TUNE_FILE or zimg_cpu_tune.tsv in the user cache directory by default, empty when kept in memory");
+	m.def("autotune_set_file", [](const std::string &path) { CpuTuner::global().setPath(path); },
+		"Set the file of the table of the measured cpu types, which is loaded on the next request, "
+		"an empty path keeps the table in memory only", "path"_a);
+	m.def("autotune_set_runs", [](unsigned runs) { CpuTuner::global().setRuns(runs); },
+		"Set the number of timed runs of each cpu type on the sample frame, 3 by default", "runs"_a);
+	m.def("autotune_table", []()
+		{
+			py::list result;
+			for (const CpuTuner::Entry &entry : CpuTuner::global().getEntries())
+			{
+				py::dict item;
+				item["key"] = entry.key;
+				item["cpu_type"] = entry.cpu_type;
+				item["time_ns"] = entry.nanoseconds;
+				result.append(item);
+			}
+			return result;
+		},
+		"Get the measured configurations of this CPU, as dicts of the key, the chosen cpu_type and its time_ns");
+	m.def("autotune_clear", []() { CpuTuner::global().clear(); },
+		"Forget the measurements of this CPU, in memory and in the file, "
+		"which is replaced atomically by a copy without them, RuntimeError is raised when it can't be written");
+	m.def("cpu_model", &CpuTuner::cpu_model,
+		"Get the CPU model keying the autotuning table, with the number of logical processors");
+	////////
+	// shared thread pool of the parallel modes (threads != 1, bands, crops, tiles, pyramids, submit)
+	// the lists of CPUs are converted by hand, as the STL casters aren't used by the module
+	const auto cpu_lists = [](const std::vector<ThreadPool::Tcpus> &lists)
+	{
+		py::list result;
+		for (const ThreadPool::Tcpus &cpus : lists)
+		{
+			py::list item;
+			for (unsigned cpu : cpus) item.append(cpu);
+			result.append(item);
+		}
+		return result;
+	};
+	m.def("pool_configure", [](unsigned threads, py::sequence affinity, bool first_touch)
+		{
+			ThreadPool::Config config;
+			config.threads = threads;
+			for (size_t k = 0; k < affinity.size(); ++k)
+			{
+				const py::sequence list = affinity[k].cast<py::sequence>();
+				ThreadPool::Tcpus cpus;
+				for (size_t i = 0; i < list.size(); ++i) cpus.push_back(list[i].cast<unsigned>());
+				if (cpus.empty())
+				{
+					throw std::runtime_error("Each affinity entry must be a non-empty list of CPUs");
+				}
+				config.affinity.push_back(cpus);
+			}
+			ThreadPool::configure(config);
+			ScratchArena::setFirstTouch(first_touch);
+		},
+		"Set the number of threads of the pool in total, including the calling thread (0 means one per hardware thread), "
+		"the lists of CPUs the worker threads run on in turn (empty for no pinning), "
+		"and whether the scratch memory is touched by the thread requesting it as soon as it is allocated, "
+		"which places the per-thread memory on the NUMA node of the thread. "
+		"The worker threads of ZFrameProcessor and the prefetching thread of FrameReader aren't part of the pool, "
+		"but are pinned following the same affinity. "
+		"Raise an error once the pool was used (including by pool_info), "
+		"thus it should be configured before processing, ideally at import time, see zimg.pool",
+		"threads"_a=0, "affinity"_a=py::list(), "first_touch"_a=false);
+	m.def("pool_info", [cpu_lists]()
+		{
+			const ThreadPool::Config config = ThreadPool::getConfig();
+			py::dict result;
+			result["threads"] = ThreadPool::global().size();
+			result["affinity"] = cpu_lists(config.affinity);
+			result["first_touch"] = ScratchArena::isFirstTouch();
+			return result;
+		},
+		"Get the number of threads of the pool, the CPUs of its workers and the first touch setting");
+	m.def("numa_nodes", [cpu_lists]() { return cpu_lists(ThreadPool::numa_nodes()); },
+		"Get the lists of CPUs of the NUMA nodes, a single list of all the CPUs when the topology is unknown");
+	////////
+	// fork handlers, registered with os.register_at_fork by the package
+	// the cached filters are immutable, thus shared copy-on-write with the child,
+	// whose thread pool is replaced as the workers don't exist there
+	// the mutexes of the cache, the tuner and the pool settings are held across the fork, always in this order
+	m.def("_fork_prepare", []()
+		{
+			ZCache::global().lock();
+			CpuTuner::global().lock();
+			ThreadPool::lock_config();
+		});
+	m.def("_fork_parent", []()
+		{
+			ThreadPool::unlock_config();
+			CpuTuner::global().unlock();
+			ZCache::global().unlock();
+		});
+	m.def("_fork_child", []()
+		{
+			ThreadPool::unlock_config();
+			CpuTuner::global().unlock();
+			ZCache::global().unlock();
+			ThreadPool::reset_global();
+		});
 }
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// fixed-size pool of worker threads shared by the parallel processing modes
+// the calling thread always takes part in parallel_for, so nested parallel_for calls
+// from inside a task can't deadlock even when all the workers are busy
+// the workers may be pinned to sets of CPUs, e.g. one per NUMA node, so that the memory
+// they first touch (their scratch arenas) stays on their node, see ScratchArena::setFirstTouch
+class ThreadPool
+{
+public:
+	typedef ThreadPool Tthis;
+	typedef std::function<void()> Ttask;
+	typedef std::vector<unsigned> Tcpus;
+
+	// settings of the process-wide instance
+	struct Config
+	{
+		unsigned threads = 0; // in total, 0 means the number of hardware threads
+		std::vector<Tcpus> affinity; // CPUs of the workers in turn, empty for no pinning
+	};
+
+	// create a pool with the specified number of threads in total (including the calling thread)
+	// 0 means the number of hardware threads
+	// the worker i runs on the CPUs affinity[i % affinity.size()], the calling thread is never pinned
+	explicit ThreadPool(unsigned threads = 0, const std::vector<Tcpus> &affinity = std::vector<Tcpus>())
+		: spare_cpus(affinity.empty() ? Tcpus() : affinity[0]), stop(false)
+	{
+		if (threads == 0)
+		{
+			threads = std::max(1U, std::thread::hardware_concurrency());
+		}
+		for (unsigned i = 1; i < threads; ++i)
+		{
+			const Tcpus cpus = affinity.empty() ? Tcpus() : affinity[(i - 1) % affinity.size()];
+			this->workers.emplace_back(&Tthis::worker_loop, this, cpus);
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stop = true;
+		}
+		this->cv.notify_all();
+		for (auto &worker : this->workers)
+		{
+			worker.join();
+		}
+		if (this->spare.joinable()) this->spare.join();
+	}
+
+	// number of threads in total, including the calling thread
+	unsigned size() const { return static_cast<unsigned>(this->workers.size()) + 1; }
+
+	// queue a task to be run by a worker thread, it never runs in the calling thread
+	// without worker threads, a spare one is started on the first task, which only runs the queued tasks,
+	// as parallel_for never queues anything then
+	// the task should not throw, as there is nowhere to report the exception
+	void submit(Ttask task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (this->workers.empty() && !this->spare.joinable())
+			{
+				this->spare = std::thread(&Tthis::worker_loop, this, this->spare_cpus);
+			}
+			this->tasks.push_back(std::move(task));
+		}
+		this->cv.notify_one();
+	}
+
+	// call fn(i) for every i in [0, count) and wait for all of them to finish
+	// at most max_threads threads are used in total, 0 means all the threads of the pool
+	// the first exception thrown by fn is rethrown in the calling thread
+	template<typename F>
+	void parallel_for(size_t count, F &&fn, unsigned max_threads = 0)
+	{
+		const unsigned threads = static_cast<unsigned>(std::min<size_t>(count,
+			max_threads ? std::min(max_threads, this->size()) : this->size()));
+
+		if (threads <= 1) // nothing to share, run in place
+		{
+			for (size_t i = 0; i < count; ++i) fn(i);
+			return;
+		}
+
+		auto job = std::make_shared<Job>(count, std::function<void(size_t)>(std::ref(fn)));
+		for (unsigned i = 1; i < threads; ++i)
+		{
+			this->submit([job]() { job->run(); });
+		}
+		job->run();
+		job->wait();
+	}
+
+	// process-wide instance, created on first use
+	static Tthis &global()
+	{
+		return *instance();
+	}
+
+	// replace the process-wide instance in the child of a fork, where its worker threads don't exist,
+	// the previous instance is leaked, and the tasks still queued in it never run
+	// should be called while no other thread uses the pool
+	static void reset_global()
+	{
+		instance() = create();
+	}
+
+	// change the settings of the process-wide instance, which is created with them on first use
+	// the instance can't be replaced once created, as other threads may be using it,
+	// thus this should be called before anything is processed, ideally at import time
+	static void configure(const Config &config)
+	{
+		std::lock_guard<std::mutex> lock(config_mutex());
+		if (created())
+		{
+			throw std::runtime_error("The thread pool is already in use, it must be configured before processing");
+		}
+		settings() = config;
+	}
+
+	static Config getConfig()
+	{
+		std::lock_guard<std::mutex> lock(config_mutex());
+		return settings();
+	}
+
+	// hold the settings mutex across a fork, so that the child doesn't inherit it locked by another thread
+	// unlock_config() should be called in both the parent and the child, before reset_global() in the child
+	static void lock_config() { config_mutex().lock(); }
+	static void unlock_config() { config_mutex().unlock(); }
+
+	// pin a long-lived thread created outside the pool (frame processors, prefetching)
+	// to the CPUs of the configured affinity at the index, nothing happens without affinity
+	static void pin_current(unsigned index)
+	{
+		const Config config = getConfig();
+		if (!config.affinity.empty()) pin_thread(config.affinity[index % config.affinity.size()]);
+	}
+
+	// CPUs of each NUMA node, a single node of all the CPUs when the topology is unknown
+	static std::vector<Tcpus> numa_nodes()
+	{
+		std::vector<Tcpus> nodes;
+#if defined(__linux__)
+		// the node ids may be sparse, e.g. "0,2" when a node is offline or has no memory
+		std::ifstream online("/sys/devices/system/node/online");
+		std::string ids;
+		if (std::getline(online, ids))
+		{
+			for (unsigned node : parse_cpus(ids))
+			{
+				std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				std::string list;
+				if (!std::getline(file, list)) continue;
+				const Tcpus cpus = parse_cpus(list);
+				if (!cpus.empty()) nodes.push_back(cpus);
+			}
+		}
+#elif defined(_WIN32)
+		ULONG highest = 0;
+		if (GetNumaHighestNodeNumber(&highest))
+		{
+			for (ULONG node = 0; node <= highest; ++node)
+			{
+				ULONGLONG mask = 0;
+				Tcpus cpus;
+				if (GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask))
+				{
+					for (unsigned cpu = 0; cpu < 64; ++cpu)
+					{
+						if (mask >> cpu & 1) cpus.push_back(cpu);
+					}
+				}
+				if (!cpus.empty()) nodes.push_back(cpus);
+			}
+		}
+#endif
+		if (nodes.empty())
+		{
+			Tcpus cpus;
+			for (unsigned cpu = 0; cpu < std::max(1U, std::thread::hardware_concurrency()); ++cpu) cpus.push_back(cpu);
+			nodes.push_back(cpus);
+		}
+		return nodes;
+	}
+
+	// CPUs (or node ids) of a list such as "0-3,8,10-11"
+	static Tcpus parse_cpus(const std::string &list)
+	{
+		Tcpus cpus;
+		size_t pos = 0;
+		while (pos < list.size())
+		{
+			size_t end = list.find(',', pos);
+			if (end == std::string::npos) end = list.size();
+			const std::string range = list.substr(pos, end - pos);
+			const size_t dash = range.find('-');
+			if (range.find_first_of("0123456789") != std::string::npos)
+			{
+				const unsigned first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+				const unsigned last = dash == std::string::npos ? first
+					: static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+				for (unsigned cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+			}
+			pos = end + 1;
+		}
+		return cpus;
+	}
+
+protected:
+	// state shared by the threads taking part in a parallel_for
+	struct Job
+	{
+		const size_t count;
+		const std::function<void(size_t)> fn;
+		std::atomic<size_t> next;
+		std::atomic<size_t> done;
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::exception_ptr error;
+
+		Job(size_t count, std::function<void(size_t)> fn)
+			: count(count), fn(std::move(fn)), next(0), done(0)
+		{}
+
+		void run()
+		{
+			for (size_t i = this->next++; i < this->count; i = this->next++)
+			{
+				try
+				{
+					this->fn(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(this->mutex);
+					if (!this->error) this->error = std::current_exception();
+				}
+				if (++this->done == this->count)
+				{
+					std::lock_guard<std::mutex> lock(this->mutex);
+					this->cv.notify_all();
+				}
+			}
+		}
+
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->cv.wait(lock, [this]() { return this->done == this->count; });
+			if (this->error) std::rethrow_exception(this->error);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	std::thread spare; // started by submit() when there is no worker thread
+	const Tcpus spare_cpus;
+	std::deque<Ttask> tasks;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stop;
+
+	ThreadPool(const Tthis &other) = delete;
+	Tthis &operator=(const Tthis &other) = delete;
+
+	static Tthis *&instance()
+	{
+		// intentionally leaked, joining the workers while unloading the module is unsafe
+		static Tthis *pool = create();
+		return pool;
+	}
+
+	static Tthis *create()
+	{
+		std::lock_guard<std::mutex> lock(config_mutex());
+		created() = true;
+		return new Tthis(settings().threads, settings().affinity);
+	}
+
+	// guards settings() and created()
+	static std::mutex &config_mutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	static Config &settings()
+	{
+		static Config config;
+		return config;
+	}
+
+	static bool &created()
+	{
+		static bool value = false;
+		return value;
+	}
+
+	// restrict the calling thread to the CPUs, return false when not supported
+	static bool pin_thread(const Tcpus &cpus)
+	{
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (unsigned cpu : cpus)
+		{
+			if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+		}
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+		DWORD_PTR mask = 0;
+		for (unsigned cpu : cpus)
+		{
+			if (cpu < sizeof(mask) * 8) mask |= static_cast<DWORD_PTR>(1) << cpu;
+		}
+		return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+		return false;
+#endif
+	}
+
+	void worker_loop(Tcpus cpus)
+	{
+		if (!cpus.empty()) pin_thread(cpus);
+		for (;;)
+		{
+			Ttask task;
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				this->cv.wait(lock, [this]() { return this->stop || !this->tasks.empty(); });
+				if (this->stop && this->tasks.empty()) return;
+				task = std::move(this->tasks.front());
+				this->tasks.pop_front();
+			}
+			task();
+		}
+	}
+};
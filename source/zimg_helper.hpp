@@ -1,15 +1,52 @@
 #pragma once
 
 #include "zimg++.hpp"
+#include "copy_kernels.hpp"
+#include "box_kernels.hpp"
+#include "thread_pool.hpp"
+#include "filter_stats.hpp"
 #include <array>
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <vector>
+#include <cmath>
 #include <cstddef>
+#include <exception>
+#include <functional>
+#include <stdexcept>
 #ifdef _WIN32
 #include <malloc.h>
 #endif
 
 const size_t ALIGNMENT = 32;
-const int MAX_PLANES = 3;
+const int MAX_PLANES = 4;
+// row pitches in multiples of this map successive rows to the same cache sets, see PlaneLayout
+const size_t ALIAS_PERIOD = 1024;
+
+// memory alignment and row pitch of the planes allocated for the graphs
+// 64-byte vectors (ZIMG_CPU_AUTO_64B) split every other access across cache lines with a 32-byte alignment,
+// and padded=true adds an alignment unit to the pitches in multiples of ALIAS_PERIOD
+// (rows of 1024, 2048 or 4096 bytes), whose rows evict each other from the cache in the vertical passes
+struct PlaneLayout
+{
+	size_t alignment = ALIGNMENT;
+	bool padded = false;
+
+	// alignment matching the vector width of a cpu type
+	static size_t cpu_alignment(zimg_cpu_type_e cpu_type)
+	{
+		return cpu_type == ZIMG_CPU_AUTO_64B ? 64 : ALIGNMENT;
+	}
+
+	// row pitch of a plane of the specified row size in bytes
+	size_t stride(size_t bytes) const
+	{
+		size_t stride = (bytes + this->alignment - 1) / this->alignment * this->alignment;
+		if (this->padded && stride % ALIAS_PERIOD == 0) stride += this->alignment;
+		return stride;
+	}
+};
 
 template<typename T = void>
 static inline T* aligned_malloc(size_t size, size_t alignment = ALIGNMENT)
@@ -34,11 +71,20 @@ static inline void aligned_free(void *ptr)
 
 // bit-copy from one 2D array to another
 // note that row_size is not width, but width * sizeof(T), based on BYTES
+// streaming=true makes large copies bypass the cache for the target, only meant for outputs
+// that are not read back soon, as the source of a filter is read right after being copied
+// simd=false always uses memcpy
 static inline void bitblt(void *dstp, std::ptrdiff_t dst_stride,
-	const void *srcp, std::ptrdiff_t src_stride, size_t row_size, size_t height)
+	const void *srcp, std::ptrdiff_t src_stride, size_t row_size, size_t height,
+	bool simd = true, bool streaming = false)
 {
 	if (height)
 	{
+		if (streaming && simd && row_size * height >= STREAM_COPY_MIN
+			&& stream_rows(dstp, dst_stride, srcp, src_stride, row_size, height))
+		{
+			return;
+		}
 		if (src_stride == dst_stride && src_stride == static_cast<std::ptrdiff_t>(row_size))
 		{
 			memcpy(dstp, srcp, row_size * height);
@@ -66,6 +112,83 @@ struct AlignedDeleter
 	}
 };
 
+// a set of aligned memory blocks reused across calls to avoid repeated allocations
+// each slot holds one block, which only grows and is released with the arena
+// *** not thread-safe, use local() to get the arena of the calling thread ***
+class ScratchArena
+{
+public:
+	enum Slot
+	{
+		SLOT_TMP = 0, // zimg temporary buffer
+		SLOT_SRC, // source planes copied in
+		SLOT_DST, // target planes copied out
+		SLOT_MID0, // intermediate images between the graphs of a pipeline
+		SLOT_MID1,
+		NUM_SLOTS
+	};
+
+	ScratchArena()
+		: sizes(), alignments()
+	{}
+
+	// get a block of at least the specified size from a slot
+	// the content is undefined, and previous pointers from the same slot are invalidated on growth
+	void *get(int slot, size_t size, size_t alignment = ALIGNMENT)
+	{
+		if (!this->blocks[slot] || this->sizes[slot] < size || this->alignments[slot] < alignment)
+		{
+			this->blocks[slot].reset(); // release before allocating, to reduce peak memory
+			this->blocks[slot].reset(aligned_malloc(std::max<size_t>(size, 1), alignment));
+			if (!this->blocks[slot])
+			{
+				this->sizes[slot] = 0;
+				throw std::bad_alloc();
+			}
+			this->sizes[slot] = size;
+			this->alignments[slot] = alignment;
+			if (first_touch()) touch(this->blocks[slot].get(), size);
+		}
+		return this->blocks[slot].get();
+	}
+
+	// write every page of the new blocks right away, so that the thread requesting a block
+	// (the owner of a local arena) touches it first, which places it on its own NUMA node by default,
+	// rather than leaving it to whichever thread writes each page first
+	static void setFirstTouch(bool enabled) { first_touch() = enabled; }
+	static bool isFirstTouch() { return first_touch(); }
+
+	// arena owned by the calling thread
+	static ScratchArena &local()
+	{
+		thread_local ScratchArena arena;
+		return arena;
+	}
+
+protected:
+	std::array<std::unique_ptr<void, AlignedDeleter>, NUM_SLOTS> blocks;
+	std::array<size_t, NUM_SLOTS> sizes;
+	std::array<size_t, NUM_SLOTS> alignments;
+
+	static std::atomic<bool> &first_touch()
+	{
+		static std::atomic<bool> enabled(false);
+		return enabled;
+	}
+
+	static void touch(void *ptr, size_t size)
+	{
+		const size_t page = 4096;
+		for (size_t offset = 0; offset < size; offset += page)
+		{
+			static_cast<volatile uint8_t *>(ptr)[offset] = 0;
+		}
+	}
+
+	ScratchArena(const ScratchArena &other) = delete;
+	ScratchArena &operator=(const ScratchArena &other) = delete;
+};
+
 // template class to store an image plane
 template<typename T>
 class ImagePlane
@@ -95,7 +218,16 @@ public:
 	// *** no guarantee about the memory alignment ***
 	ImagePlane(int64_t width, int64_t height, Tdiff stride, void *data)
 		: width(width), height(height), stride(stride),
-		data(static_cast<pointer>(data), [](void *ptr) {})
+		data(Tptr(), static_cast<pointer>(data)) // non-owning, without allocating a control block
+	{}
+
+	// create an instance refering to a block of a scratch arena
+	// stride is automatically calculated, the memory stays owned by the arena,
+	// and is only valid until the next request to the same slot
+	// *** memory alignment is guaranteed ***
+	ImagePlane(int64_t width, int64_t height, ScratchArena &arena, int slot)
+		: width(width), height(height), stride(this->cal_stride(width)),
+		data(Tptr(), static_cast<pointer>(arena.get(slot, this->cal_stride(width) * height)))
 	{}
 
 	// create an instance refering to the existing data
@@ -155,6 +287,12 @@ public:
 		return (static_cast<size_t>(width) * sizeof(T) + alignment - 1) / alignment * alignment;
 	}
 
+	// stride following a plane layout, which may be padded beyond the minimum
+	static Tdiff cal_stride(int64_t width, const PlaneLayout &layout)
+	{
+		return layout.stride(static_cast<size_t>(width) * sizeof(T));
+	}
+
 	// static function to allocate aligned memory and return a smart pointer
 	static Tptr allocate(size_t size, size_t alignment = ALIGNMENT)
 	{
@@ -202,6 +340,11 @@ public:
 		this->planes[2] = plane2;
 	}
 
+	// create an image with the first num_planes planes of an array
+	Image(const TplaneArr &planes, int num_planes)
+		: num_planes(num_planes), planes(planes)
+	{}
+
 	int getNumPlanes() const { return this->num_planes; }
 	const Tplane &getPlane(int p = 0) const { return this->planes[p]; }
 	int64_t getWidth(int p = 0) const { return this->planes[p].getWidth(); }
@@ -216,6 +359,41 @@ protected:
 	TplaneArr planes;
 };
 
+// size in bytes of a single pixel of the specified type
+static inline size_t pixel_size(zimg_pixel_type_e pixel_type)
+{
+	return pixel_type == ZIMG_PIXEL_FLOAT ? 4 : pixel_type == ZIMG_PIXEL_BYTE ? 1 : 2;
+}
+
+// whether a format has an alpha plane, which is always the 4th plane of zimg buffers
+static inline bool has_alpha(const zimgxx::zimage_format &format)
+{
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+	return format.alpha != ZIMG_ALPHA_NONE;
+#else
+	return false;
+#endif
+}
+
+// number of planes of a format, including the alpha plane
+static inline int plane_count(const zimgxx::zimage_format &format)
+{
+	return (format.color_family == ZIMG_COLOR_GREY ? 1 : 3) + (has_alpha(format) ? 1 : 0);
+}
+
+// index in zimg buffers of the c-th plane of a format, as the alpha plane follows the unused chroma planes of GREY
+static inline int plane_index(const zimgxx::zimage_format &format, int c)
+{
+	return has_alpha(format) && c == plane_count(format) - 1 ? 3 : c;
+}
+
+// whether the c-th plane of a format is a chroma plane, thus subsampled
+static inline bool is_chroma(const zimgxx::zimage_format &format, int c)
+{
+	const int p = plane_index(format, c);
+	return p == 1 || p == 2;
+}
+
 struct ZResizeParams
 {
 	// format parameters
@@ -223,23 +401,121 @@ struct ZResizeParams
 	zimg_color_family_e color_family = ZIMG_COLOR_GREY;
 	unsigned depth = 8;
 	zimg_pixel_range_e pixel_range = ZIMG_RANGE_FULL;
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+	zimg_alpha_type_e alpha = ZIMG_ALPHA_NONE;
+#endif
 	// graph parameters
 	zimg_resample_filter_e filter = ZIMG_RESIZE_BICUBIC;
 	double filter_a = NAN;
 	double filter_b = NAN;
 	zimg_dither_type_e dither_type = ZIMG_DITHER_NONE;
 	zimg_cpu_type_e cpu_type = ZIMG_CPU_AUTO;
+	// maximum factor (2 or 4) of an area average of the source before the resize graph, 0 or 1 disables it,
+	// see ZFilter::reduce_factor
+	unsigned prereduce = 0;
 
+	// 2 and 4 planes are GREY and RGB with straight alpha
 	static ZResizeParams build(int planes = 1, unsigned depth = 8)
 	{
 		ZResizeParams params;
 		params.pixel_type = depth > 16 ? ZIMG_PIXEL_FLOAT : depth > 8 ? ZIMG_PIXEL_WORD : ZIMG_PIXEL_BYTE;
-		params.color_family = planes > 1 ? ZIMG_COLOR_RGB : ZIMG_COLOR_GREY;
+		params.color_family = planes > 2 ? ZIMG_COLOR_RGB : ZIMG_COLOR_GREY;
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+		params.alpha = planes == 2 || planes == 4 ? ZIMG_ALPHA_STRAIGHT : ZIMG_ALPHA_NONE;
+#endif
 		params.depth = depth;
 		return params;
 	}
 };
 
+// ring buffer holding a power-of-2 number of rows of every plane,
+// so that images can be processed with row callbacks without being entirely in memory
+class LineBuffer
+{
+public:
+	typedef LineBuffer Tthis;
+	typedef std::ptrdiff_t Tdiff;
+	typedef std::unique_ptr<uint8_t, AlignedDeleter> Tptr;
+
+	// default constructor
+	LineBuffer()
+		: num_planes(0), mask(0), subsample_w(0), subsample_h(0), pixel(0),
+		indices(), masks(), widths(), rows(), strides()
+	{}
+
+	// allocate the rows of every plane for the format
+	// buffering is the number of rows required by the graph (get_input_buffering or get_output_buffering),
+	// ZIMG_BUFFER_MAX holds the whole image
+	LineBuffer(const zimgxx::zimage_format &format, unsigned buffering, const PlaneLayout &layout = PlaneLayout())
+		: num_planes(plane_count(format)),
+		mask(zimg_select_buffer_mask(buffering)),
+		subsample_w(format.subsample_w), subsample_h(format.subsample_h),
+		pixel(pixel_size(format.pixel_type)), indices(), masks(), widths(), rows(), strides()
+	{
+		for (int p = 0; p < this->num_planes; ++p)
+		{
+			const bool chroma = is_chroma(format, p);
+			const unsigned sw = chroma ? this->subsample_w : 0;
+			const unsigned sh = chroma ? this->subsample_h : 0;
+			this->indices[p] = plane_index(format, p);
+			this->masks[p] = this->mask == ZIMG_BUFFER_MAX ? this->mask : this->mask >> sh;
+			this->widths[p] = (format.width + (1U << sw) - 1) >> sw;
+			this->rows[p] = this->mask == ZIMG_BUFFER_MAX ? (format.height + (1U << sh) - 1) >> sh : (this->mask >> sh) + 1;
+			this->strides[p] = layout.stride(this->widths[p] * this->pixel);
+			this->data[p].reset(aligned_malloc<uint8_t>(std::max<size_t>(this->strides[p] * this->rows[p], 1), layout.alignment));
+			if (!this->data[p]) throw std::bad_alloc();
+		}
+	}
+
+	int getNumPlanes() const { return this->num_planes; }
+	unsigned getSubsampleW() const { return this->subsample_w; }
+	unsigned getSubsampleH() const { return this->subsample_h; }
+	size_t getPixelSize() const { return this->pixel; }
+	unsigned getWidth(int p = 0) const { return this->widths[p]; }
+	unsigned getRows(int p = 0) const { return this->rows[p]; }
+	Tdiff getStride(int p = 0) const { return this->strides[p]; }
+
+	// row mask of a plane, as passed to zimg
+	unsigned getMask(int p = 0) const { return this->masks[p]; }
+
+	// pointer to the row i of a plane, i is the row index in the whole plane
+	void *getRow(int p, unsigned i) const
+	{
+		return this->data[p].get() + (i & this->getMask(p)) * this->strides[p];
+	}
+
+	// set the planes of a zimg buffer
+	template<typename Tbuffer>
+	void fill(Tbuffer &buffer) const
+	{
+		for (int p = 0; p < this->num_planes; ++p)
+		{
+			buffer.data(this->indices[p]) = this->data[p].get();
+			buffer.stride(this->indices[p]) = this->strides[p];
+			buffer.mask(this->indices[p]) = this->masks[p];
+		}
+	}
+
+protected:
+	int num_planes;
+	unsigned mask;
+	unsigned subsample_w;
+	unsigned subsample_h;
+	size_t pixel;
+	std::array<int, MAX_PLANES> indices; // plane indices in zimg buffers
+	std::array<unsigned, MAX_PLANES> masks;
+	std::array<unsigned, MAX_PLANES> widths;
+	std::array<unsigned, MAX_PLANES> rows;
+	std::array<Tdiff, MAX_PLANES> strides;
+	std::array<Tptr, MAX_PLANES> data;
+};
+
+// wrapper of zimg filter graph with the temporary buffer it requires
+// thread safety: the graph itself is immutable after construction,
+// but tmp_buf and the scratch arena are shared by all the calls on the same instance,
+// thus different instances can be used concurrently while a single instance can not
+// a concurrent instance instead takes the temporary memory from the arena of the calling thread,
+// thus it can be called from multiple threads at the same time
 class ZFilter
 {
 public:
@@ -250,9 +526,14 @@ public:
 	typedef zimgxx::zimage_buffer Zbuffer;
 	typedef zimgxx::zimage_buffer_const ZbufferC;
 	typedef std::unique_ptr<void, AlignedDeleter> TempPtr;
+	// row callback, called as (i, left, right) for the rows [i, i + (1 << subsample_h)) of the image
+	// and the columns [left, right) of the first plane
+	typedef std::function<void(unsigned, unsigned, unsigned)> Tcallback;
 
 	// create an instance based on zimage format and zfilter graph params
-	ZFilter(const Zformat &src_format, const Zformat &dst_format, const Zparams &params)
+	ZFilter(const Zformat &src_format, const Zformat &dst_format, const Zparams &params,
+		bool concurrent = false)
+		: concurrent(concurrent)
 	{
 		// build graph
 		this->init(src_format, dst_format, params);
@@ -261,31 +542,182 @@ public:
 	// create an instance based on a custom resize parameters
 	// can only perform resizing without other colorspace conversions
 	ZFilter(const ZResizeParams &params,
+		unsigned src_width, unsigned src_height, unsigned dst_width, unsigned dst_height,
+		double roi_left = 0, double roi_top = 0, double roi_width = 0, double roi_height = 0,
+		bool concurrent = false)
+		: concurrent(concurrent)
+	{
+		Zformat src_format;
+		Zformat dst_format;
+		Zparams g_params;
+		resize_formats(src_format, dst_format, g_params, params,
+			src_width, src_height, dst_width, dst_height,
+			roi_left, roi_top, roi_width, roi_height);
+		// build graph, preceded by an area average for large downscales
+		const unsigned factor = reduce_factor(params.prereduce, src_format, dst_format);
+		if (factor > 1)
+		{
+			this->init_stages(reduce_stages(src_format, dst_format, g_params, factor));
+		}
+		else
+		{
+			this->init(src_format, dst_format, g_params);
+		}
+	}
+
+	// a step of a pipeline, converting src_format to dst_format with its own graph params
+	// box > 1 is an area average of box x box blocks instead of a graph, see reduce_stages()
+	struct Stage
+	{
+		Zformat src_format;
+		Zformat dst_format;
+		Zparams params;
+		unsigned box = 0;
+	};
+
+	// create a pipeline running the stages one after another as a single filter,
+	// the intermediate images are kept in temporary memory between the graphs
+	// the stages are expected to be prepared by plan_stages()
+	explicit ZFilter(const std::vector<Stage> &stages, bool concurrent = false)
+		: concurrent(concurrent)
+	{
+		// build graphs
+		this->init_stages(stages);
+	}
+
+	// prepare the stages of a pipeline, the target format of each one should match the source format of the next one
+	// - a pure resize (formats only differ in dimensions) takes the format of the image it receives,
+	//   so that it never converts anything by itself
+	// - reorder=true moves a pure resize before a conversion keeping the dimensions when downscaling,
+	//   and after it when upscaling, so that the conversion runs on the smaller image
+	//   only conversions keeping the transfer and primaries are moved, as resizing on the other side
+	//   of a gamma or gamut change gives a visibly different image
+	// - fuse=true merges adjacent stages with the same graph params into a single graph,
+	//   when at least one of them keeps the dimensions
+	// reordered and fused stages move or skip the intermediate rounding,
+	// thus the output is not bit-exact with running the stages one by one
+	// area averages (box > 1) are neither adapted, reordered nor fused
+	static std::vector<Stage> plan_stages(std::vector<Stage> stages, bool reorder = true, bool fuse = true)
+	{
+		// adapt the pure resizes to the neighbouring formats
+		for (size_t k = 0; k < stages.size(); ++k)
+		{
+			Stage &stage = stages[k];
+			const Zformat *ref = k > 0 ? &stages[k - 1].dst_format
+				: k + 1 < stages.size() ? &stages[k + 1].src_format : nullptr;
+			if (ref && is_resize(stage) && !stage.box)
+			{
+				Zformat src = with_size(*ref, stage.src_format.width, stage.src_format.height);
+				src.active_region = stage.src_format.active_region;
+				stage.dst_format = with_size(*ref, stage.dst_format.width, stage.dst_format.height);
+				stage.src_format = src;
+			}
+		}
+		for (size_t k = 1; k < stages.size(); ++k)
+		{
+			if (!same_format(stages[k - 1].dst_format, stages[k].src_format))
+			{
+				throw std::runtime_error("Target format of each stage must match the source format of the next one");
+			}
+		}
+
+		// move the conversions to the smaller side of the resizes
+		for (bool changed = reorder; changed; )
+		{
+			changed = false;
+			for (size_t k = 1; k < stages.size(); ++k)
+			{
+				const Stage &a = stages[k - 1];
+				const Stage &b = stages[k];
+				const bool down = keeps_size(a) && is_resize(b) && area(b.dst_format) < area(b.src_format);
+				const bool up = is_resize(a) && keeps_size(b) && area(a.dst_format) > area(a.src_format);
+				if ((!down && !up) || a.box || b.box)
+				{
+					continue;
+				}
+				const Stage &convert = down ? a : b;
+				if (!same_light(convert.src_format, convert.dst_format))
+				{
+					continue;
+				}
+				const Stage &resize = down ? b : a;
+				// the conversion runs at the smaller size, in the format it had anyway
+				const Zformat &small = down ? resize.dst_format : resize.src_format;
+				Stage new_convert = { with_size(convert.src_format, small.width, small.height),
+					with_size(convert.dst_format, small.width, small.height), convert.params };
+				// the resize runs in the format on its side of the conversion
+				const Zformat &format = down ? convert.src_format : convert.dst_format;
+				Stage new_resize = { with_size(format, resize.src_format.width, resize.src_format.height),
+					with_size(format, resize.dst_format.width, resize.dst_format.height), resize.params };
+				new_resize.src_format.active_region = resize.src_format.active_region;
+				if (!fits(new_convert.src_format) || !fits(new_convert.dst_format)
+					|| !fits(new_resize.src_format) || !fits(new_resize.dst_format))
+				{
+					continue;
+				}
+				stages[k - 1] = down ? new_resize : new_convert;
+				stages[k] = down ? new_convert : new_resize;
+				changed = true;
+			}
+		}
+
+		// merge the stages sharing the same params into a single graph
+		if (fuse)
+		{
+			std::vector<Stage> fused;
+			for (const Stage &stage : stages)
+			{
+				Stage *prev = fused.empty() ? nullptr : &fused.back();
+				if (prev && !prev->box && !stage.box && same_params(prev->params, stage.params)
+					&& (keeps_size(*prev) || keeps_size(stage)))
+				{
+					if (keeps_size(*prev))
+					{
+						prev->src_format.active_region = stage.src_format.active_region;
+					}
+					prev->dst_format = stage.dst_format;
+				}
+				else
+				{
+					fused.push_back(stage);
+				}
+			}
+			stages.swap(fused);
+		}
+		return stages;
+	}
+
+	// convert custom resize parameters to zimage formats and zfilter graph params
+	static void resize_formats(Zformat &src_format, Zformat &dst_format, Zparams &g_params,
+		const ZResizeParams &params,
 		unsigned src_width, unsigned src_height, unsigned dst_width, unsigned dst_height,
 		double roi_left = 0, double roi_top = 0, double roi_width = 0, double roi_height = 0)
 	{
 		// source format
-		Zformat src_format;
 		src_format.width = src_width;
 		src_format.height = src_height;
 		src_format.pixel_type = params.pixel_type;
 		src_format.color_family = params.color_family;
 		src_format.depth = params.depth;
 		src_format.pixel_range = params.pixel_range;
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+		src_format.alpha = params.alpha;
+#endif
 		src_format.active_region.left = roi_left;
 		src_format.active_region.top = roi_top;
 		src_format.active_region.width = roi_width > 0 ? roi_width : src_width - roi_width;
 		src_format.active_region.height = roi_height > 0 ? roi_height : src_height - roi_height;
 		// target format
-		Zformat dst_format;
 		dst_format.width = dst_width;
 		dst_format.height = dst_height;
 		dst_format.pixel_type = params.pixel_type;
 		dst_format.color_family = params.color_family;
 		dst_format.depth = params.depth;
 		dst_format.pixel_range = params.pixel_range;
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+		dst_format.alpha = params.alpha;
+#endif
 		// graph parameters
-		Zparams g_params;
 		g_params.resample_filter = params.filter;
 		g_params.filter_param_a = params.filter_a;
 		g_params.filter_param_b = params.filter_b;
@@ -294,8 +726,323 @@ public:
 		g_params.filter_param_b_uv = params.filter_b;
 		g_params.dither_type = params.dither_type;
 		g_params.cpu_type = params.cpu_type;
-		// build graph
-		this->init(src_format, dst_format, g_params);
+	}
+
+	// factor of the area average run before a resize graph, the largest of 4 and 2 not above max_factor,
+	// dividing the source dimensions, and leaving at least a 2x downscale to the graph, 1 if none applies
+	// each target pixel then averages factor x factor source pixels before the resampling filter,
+	// whose support still covers at least 2 reduced pixels, so the aliasing stays bounded by the filter
+	// the output is not bit-exact with the single graph: the box response attenuates the frequencies
+	// near the target Nyquist limit slightly more, which mostly shows as a softer result with sharp filters
+	// (Lanczos, Spline64), and the integer averages add a rounding of at most half a step
+	// straight alpha keeps the single graph, as averaging the colors without premultiplying them
+	// would let the transparent pixels bleed into the visible ones, which zimg itself avoids
+	static unsigned reduce_factor(unsigned max_factor, const Zformat &src_format, const Zformat &dst_format)
+	{
+		if (src_format.pixel_type == ZIMG_PIXEL_HALF || src_format.field_parity != ZIMG_FIELD_PROGRESSIVE
+			|| src_format.subsample_w || src_format.subsample_h)
+		{
+			return 1;
+		}
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+		if (src_format.alpha == ZIMG_ALPHA_STRAIGHT)
+		{
+			return 1;
+		}
+#endif
+		const auto &region = src_format.active_region;
+		const double width = std::isnan(region.width) ? src_format.width : region.width;
+		const double height = std::isnan(region.height) ? src_format.height : region.height;
+		for (unsigned factor = 4; factor > 1; factor /= 2)
+		{
+			if (factor <= max_factor && src_format.width % factor == 0 && src_format.height % factor == 0
+				&& width >= 2.0 * factor * dst_format.width && height >= 2.0 * factor * dst_format.height)
+			{
+				return factor;
+			}
+		}
+		return 1;
+	}
+
+	// stages of a resize preceded by an area average of the whole source,
+	// the active region is scaled to the reduced image, whose pixels keep the same centers
+	static std::vector<Stage> reduce_stages(const Zformat &src_format, const Zformat &dst_format,
+		const Zparams &params, unsigned factor)
+	{
+		Stage box = { with_size(src_format, src_format.width, src_format.height),
+			with_size(src_format, src_format.width / factor, src_format.height / factor), params };
+		box.box = factor;
+		Stage resize = { box.dst_format, dst_format, params };
+		resize.src_format.active_region.left = src_format.active_region.left / factor;
+		resize.src_format.active_region.top = src_format.active_region.top / factor;
+		resize.src_format.active_region.width = src_format.active_region.width / factor;
+		resize.src_format.active_region.height = src_format.active_region.height / factor;
+		return std::vector<Stage>{ box, resize };
+	}
+
+	// radius in source pixels of the samples read around each target pixel by the resampling filters,
+	// when resizing a source extent of src_size pixels to dst_size pixels
+	static double filter_support(const Zparams &params, double src_size, unsigned dst_size)
+	{
+		const auto taps = [](zimg_resample_filter_e filter, double a)
+		{
+			switch (filter)
+			{
+			case ZIMG_RESIZE_POINT: return 0.5;
+			case ZIMG_RESIZE_BILINEAR: return 1.0;
+			case ZIMG_RESIZE_BICUBIC: return 2.0;
+			case ZIMG_RESIZE_SPLINE16: return 2.0;
+			case ZIMG_RESIZE_SPLINE36: return 3.0;
+			case ZIMG_RESIZE_SPLINE64: return 4.0;
+			case ZIMG_RESIZE_LANCZOS: return std::isnan(a) ? 3.0 : std::max(1.0, std::floor(a));
+			default: return 4.0;
+			}
+		};
+		const double radius = std::max(taps(params.resample_filter, params.filter_param_a),
+			taps(params.resample_filter_uv, params.filter_param_a_uv));
+		// downscaling stretches the filter over the source
+		return radius * std::max(1.0, src_size / dst_size);
+	}
+
+	// source range [begin, end) within [0, limit) holding every sample read to resize the extent
+	// [left, left + size) to dst_size pixels, begin is rounded down to a multiple of align
+	// a graph reading only this range gives the same result as one reading the whole source,
+	// since the filter never reaches the borders of the range, except where they are the borders of the image
+	static void support_span(unsigned &begin, unsigned &end, const Zparams &params,
+		double left, double size, unsigned dst_size, unsigned limit, unsigned align = 1)
+	{
+		const double margin = std::ceil(filter_support(params, size, dst_size)) + 1;
+		const double first = std::max(0.0, std::floor(left) - margin);
+		const double last = std::min(static_cast<double>(limit), std::ceil(left + size) + margin);
+		begin = static_cast<unsigned>(first) / align * align;
+		end = static_cast<unsigned>(last);
+	}
+
+	// source window [begin, end) and active region [left, left + size) within it of the target range [first, last),
+	// along an axis mapping the source region [region_left, region_left + region_size) to dst_size pixels
+	// an axis without resizing takes exactly the target range, so that the graph of the tile doesn't resize it either
+	static void tile_span(unsigned &begin, unsigned &end, double &left, double &size, const Zparams &params,
+		double region_left, double region_size, unsigned src_size, unsigned dst_size,
+		unsigned first, unsigned last, unsigned align = 1)
+	{
+		if (region_left == 0 && region_size == src_size && dst_size == src_size)
+		{
+			begin = first;
+			end = last;
+			left = 0;
+			size = last - first;
+			return;
+		}
+		const double scale = region_size / dst_size;
+		const double origin = region_left + first * scale;
+		size = (last - first) * scale;
+		support_span(begin, end, params, origin, size, last - first, src_size, align);
+		left = origin - begin;
+	}
+
+	const Zformat &getSrcFormat() const { return this->src_format; }
+	const Zformat &getDstFormat() const { return this->dst_format; }
+	const Zparams &getParams() const { return this->params; }
+	bool isConcurrent() const { return this->concurrent; }
+
+	// scratch arena for the memory used around the graph, sized on first use and reused by the following calls
+	// it is owned by the instance, or by the calling thread for a concurrent instance or local=true
+	ScratchArena &getArena(bool local = false) const
+	{
+		return this->concurrent || local ? ScratchArena::local() : this->arena;
+	}
+	// stages of a pipeline, a single filter graph is a single stage
+	std::vector<Stage> getStages() const
+	{
+		if (!this->stages.empty()) return this->stages;
+		return std::vector<Stage>{ Stage{ this->src_format, this->dst_format, this->params } };
+	}
+
+	// size of the temporary buffer required by the graphs
+	size_t getTmpSize() const
+	{
+		if (this->stages.empty()) return this->graph.get_tmp_size();
+		size_t size = 0;
+		for (size_t k = 0; k < this->stages.size(); ++k)
+		{
+			if (!this->stages[k].box) size = std::max(size, this->chain[k].get_tmp_size());
+		}
+		return size;
+	}
+
+	// counters of the calls on this instance, disabled by default
+	FilterStats &getStats() const { return this->stats; }
+
+	// memory layout of the planes and temporary memory allocated around the graphs,
+	// the alignment follows the cpu type, and the strides are not padded by default
+	const PlaneLayout &getLayout() const { return this->layout; }
+
+	// the alignment should be a power of 2 of at least ALIGNMENT, the temporary buffer is reallocated
+	// *** not to be called while the instance is processing ***
+	void setLayout(const PlaneLayout &layout)
+	{
+		if (layout.alignment < ALIGNMENT || (layout.alignment & (layout.alignment - 1)))
+		{
+			throw std::runtime_error("Alignment must be a power of 2 of at least 32 bytes");
+		}
+		this->layout = layout;
+		if (!this->concurrent)
+		{
+			this->tmp_buf = TempPtr(aligned_malloc(this->getTmpSize(), this->layout.alignment), AlignedDeleter());
+		}
+	}
+
+	unsigned getBands() const { return std::max<unsigned>(1, static_cast<unsigned>(this->bands.size())); }
+
+	// split the target image into row bands, which are processed in parallel by the thread pool
+	// each band has its own filter graph reading the matching source region,
+	// and the output stays bit-exact with the single graph:
+	// - without vertical resizing, each band simply processes its own source rows
+	// - with vertical resizing, each band reads the whole source through a shifted active region,
+	//   and band boundaries are only placed where every row maps to exactly the same position
+	// rows depending on each other in other ways (vertical chroma subsampling, interlacing,
+	// dithering) keep a single band
+	// count=0 means one band per thread of the pool, return the number of bands actually formed
+	// a pipeline of several stages keeps a single band
+	unsigned setBands(unsigned count)
+	{
+		const unsigned min_band_height = 16;
+		const Zformat &src = this->src_format;
+		const Zformat &dst = this->dst_format;
+		this->bands.clear();
+
+		if (!this->stages.empty())
+		{
+			return this->getBands();
+		}
+
+		if (count == 0)
+		{
+			count = ThreadPool::global().size();
+		}
+		count = std::min(count, dst.height / min_band_height);
+		if (count <= 1 || src.field_parity != ZIMG_FIELD_PROGRESSIVE || dst.field_parity != ZIMG_FIELD_PROGRESSIVE
+			|| src.subsample_h || dst.subsample_h || this->params.dither_type != ZIMG_DITHER_NONE)
+		{
+			return this->getBands();
+		}
+
+		// vertical mapping of the full graph
+		const double top = std::isnan(src.active_region.top) ? 0 : src.active_region.top;
+		const double height = std::isnan(src.active_region.height) ? src.height : src.active_region.height;
+		const bool resize_v = top != 0 || height != src.height || dst.height != src.height;
+		// with an integer source height, row positions repeat every period rows
+		unsigned period = 1;
+		if (resize_v && height == std::floor(height) && height > 0)
+		{
+			unsigned a = dst.height, b = static_cast<unsigned>(height);
+			while (b) { const unsigned t = a % b; a = b; b = t; }
+			period = dst.height / a;
+		}
+
+		std::vector<Band> result;
+		for (unsigned b = 0, y0 = 0; y0 < dst.height; ++b)
+		{
+			const unsigned ideal = b + 1 >= count ? dst.height : (b + 1) * dst.height / count;
+			unsigned y1 = ideal;
+			if (resize_v) // search the nearest exact boundary, or extend the band to the bottom
+			{
+				y1 = dst.height;
+				unsigned candidate = (std::max(ideal, y0 + 1) + period - 1) / period * period;
+				for (int tries = 0; tries < 64 && candidate < dst.height; ++tries, candidate += period)
+				{
+					if (band_exact(y0, candidate, top, height, dst.height))
+					{
+						y1 = candidate;
+						break;
+					}
+				}
+				if (y1 == dst.height && !band_exact(y0, y1, top, height, dst.height))
+				{
+					return this->getBands();
+				}
+			}
+
+			// band formats
+			Zformat band_src = src;
+			Zformat band_dst = dst;
+			band_dst.height = y1 - y0;
+			if (resize_v)
+			{
+				band_src.active_region.left = std::isnan(src.active_region.left) ? 0 : src.active_region.left;
+				band_src.active_region.width = std::isnan(src.active_region.width) ? src.width : src.active_region.width;
+				band_src.active_region.top = top + static_cast<double>(y0) * height / dst.height;
+				band_src.active_region.height = static_cast<double>(y1 - y0) * height / dst.height;
+			}
+			else
+			{
+				band_src.height = y1 - y0;
+				if (!std::isnan(src.active_region.height)) band_src.active_region.height = y1 - y0;
+			}
+
+			Band band;
+			band.src_top = resize_v ? 0 : y0;
+			band.dst_top = y0;
+			band.graph = Zgraph::build(band_src, band_dst, &this->params);
+			result.push_back(std::move(band));
+			y0 = y1;
+		}
+
+		if (result.size() > 1)
+		{
+			this->bands = std::move(result);
+		}
+		return this->getBands();
+	}
+
+	// row buffers for streaming, holding as many rows as the graph requires
+	LineBuffer createSrcLines() const
+	{
+		this->check_stream();
+		return LineBuffer(this->src_format, this->graph.get_input_buffering(), this->layout);
+	}
+
+	LineBuffer createDstLines() const
+	{
+		this->check_stream();
+		return LineBuffer(this->dst_format, this->graph.get_output_buffering(), this->layout);
+	}
+
+	// perform conversion through row callbacks, so that neither image has to be entirely in memory
+	// unpack should write the requested source rows into src_lines before returning,
+	// and pack should consume the requested target rows from dst_lines before returning
+	// the same rows may be requested several times when the graph processes the image in column tiles
+	// an empty callback means the lines buffer holds the whole image (ZIMG_BUFFER_MAX)
+	// the first exception thrown by a callback aborts the processing and is rethrown
+	// a pipeline of several stages can't be streamed
+	void stream(const LineBuffer &src_lines, const LineBuffer &dst_lines,
+		const Tcallback &unpack, const Tcallback &pack, bool local = false) const
+	{
+		this->check_stream();
+		FilterStats::Timer timer(this->stats, FilterStats::PHASE_PROCESS);
+
+		ZbufferC buf_src;
+		Zbuffer buf_dst;
+		src_lines.fill(buf_src);
+		dst_lines.fill(buf_dst);
+
+		std::exception_ptr error;
+		StreamContext unpack_ctx = { &unpack, &error };
+		StreamContext pack_ctx = { &pack, &error };
+		void *tmp = this->concurrent || local
+			? ScratchArena::local().get(ScratchArena::SLOT_TMP, this->graph.get_tmp_size(), this->layout.alignment)
+			: this->tmp_buf.get();
+		try
+		{
+			this->graph.process(buf_src, buf_dst, tmp,
+				unpack ? &Tthis::stream_callback : nullptr, &unpack_ctx,
+				pack ? &Tthis::stream_callback : nullptr, &pack_ctx);
+		}
+		catch (...) // zimg reports the failure of a callback as its own error
+		{
+			if (!error) throw;
+		}
+		if (error) std::rethrow_exception(error);
 	}
 
 	// perform conversion on image data pointer (=ZIMG_COLOR_GREY)
@@ -310,7 +1057,7 @@ public:
 		buf_dst.data(0) = dst;
 		buf_dst.stride(0) = dst_stride;
 		buf_dst.mask(0) = ZIMG_BUFFER_MAX;
-		this->graph.process(buf_src, buf_dst, this->tmp_buf.get());
+		this->process(buf_src, buf_dst);
 	}
 
 	// perform conversion on image data pointer (!=ZIMG_COLOR_GREY)
@@ -331,46 +1078,66 @@ public:
 			buf_dst.stride(p) = dst_stride[p];
 			buf_dst.mask(p) = ZIMG_BUFFER_MAX;
 		}
-		this->graph.process(buf_src, buf_dst, this->tmp_buf.get());
+		this->process(buf_src, buf_dst);
 	}
 
 	// perform conversion on ImagePlane
 	// should be called only when color family is ZIMG_COLOR_GREY
-	template<typename T>
-	void operator()(ImagePlane<T> &dst, const ImagePlane<T> &src)
+	template<typename T, typename U>
+	void operator()(ImagePlane<U> &dst, const ImagePlane<T> &src)
 	{
 		this->operator()(dst.getData(), src.getData(),
 			dst.getStride(), src.getStride());
 	}
 
 	// perform conversion on Image
-	// should not be called when color family is ZIMG_COLOR_GREY
-	template<typename T>
-	void operator()(Image<T> &dst, const Image<T> &src)
+	// should not be called when color family is ZIMG_COLOR_GREY without alpha
+	// the planes follow the order of the format, with the alpha plane last
+	// local=true uses the temporary buffer of the calling thread,
+	// so that calls on the same instance can be made from multiple threads
+	template<typename T, typename U>
+	void operator()(Image<U> &dst, const Image<T> &src, bool local = false)
 	{
 		Zbuffer buf_dst;
 		ZbufferC buf_src;
 		for (int p = 0; p < src.getNumPlanes(); ++p)
 		{
-			buf_src.data(p) = src.getData(p);
-			buf_src.stride(p) = src.getStride(p);
-			buf_src.mask(p) = ZIMG_BUFFER_MAX;
+			const int index = plane_index(this->src_format, p);
+			buf_src.data(index) = src.getData(p);
+			buf_src.stride(index) = src.getStride(p);
+			buf_src.mask(index) = ZIMG_BUFFER_MAX;
 		}
 		for (int p = 0; p < dst.getNumPlanes(); ++p)
 		{
-			buf_dst.data(p) = dst.getData(p);
-			buf_dst.stride(p) = dst.getStride(p);
-			buf_dst.mask(p) = ZIMG_BUFFER_MAX;
+			const int index = plane_index(this->dst_format, p);
+			buf_dst.data(index) = dst.getData(p);
+			buf_dst.stride(index) = dst.getStride(p);
+			buf_dst.mask(index) = ZIMG_BUFFER_MAX;
 		}
-		this->graph.process(buf_src, buf_dst, this->tmp_buf.get());
+		this->process(buf_src, buf_dst, local);
 	}
 
 protected:
+	// a range of rows of the target image with its own filter graph
+	struct Band
+	{
+		unsigned src_top; // first source row passed to the graph
+		unsigned dst_top; // first target row written by the graph
+		Zgraph graph;
+	};
+
 	Zformat src_format;
 	Zformat dst_format;
 	Zparams params;
 	Zgraph graph;
 	TempPtr tmp_buf;
+	mutable ScratchArena arena;
+	bool concurrent;
+	PlaneLayout layout;
+	std::vector<Band> bands;
+	std::vector<Stage> stages; // only set for a pipeline, of several stages or of an area average
+	std::vector<Zgraph> chain; // graphs of the stages of a pipeline, empty for the area averages
+	mutable FilterStats stats;
 
 	// disable copy constructor and copy assignment, as tmp_buf should not be shared
 	ZFilter(const Tthis &other) = delete;
@@ -383,6 +1150,314 @@ protected:
 		this->dst_format = dst_format;
 		this->params = params;
 		this->graph = Zgraph::build(src_format, dst_format, &params);
-		this->tmp_buf = TempPtr(aligned_malloc(this->graph.get_tmp_size(), ALIGNMENT), AlignedDeleter());
+		this->layout.alignment = PlaneLayout::cpu_alignment(params.cpu_type);
+		if (!this->concurrent)
+		{
+			this->tmp_buf = TempPtr(aligned_malloc(this->graph.get_tmp_size(), this->layout.alignment), AlignedDeleter());
+		}
+	}
+
+	// initialize a pipeline, a single graph is initialized as by init()
+	void init_stages(const std::vector<Stage> &stages)
+	{
+		if (stages.empty())
+		{
+			throw std::runtime_error("Pipeline requires at least one stage");
+		}
+		if (stages.size() == 1 && !stages.front().box)
+		{
+			this->init(stages.front().src_format, stages.front().dst_format, stages.front().params);
+			return;
+		}
+		this->src_format = stages.front().src_format;
+		this->dst_format = stages.back().dst_format;
+		this->params = stages.front().params;
+		for (const Stage &stage : stages)
+		{
+			if (stage.box && !box_fits(stage))
+			{
+				throw std::runtime_error("Area average requires BYTE, WORD or FLOAT pixels, "
+					"a factor of 2 or 4 dividing the dimensions, and no active region");
+			}
+			this->chain.push_back(stage.box ? Zgraph() : Zgraph::build(stage.src_format, stage.dst_format, &stage.params));
+		}
+		this->stages = stages;
+		for (const Stage &stage : stages)
+		{
+			this->layout.alignment = std::max(this->layout.alignment, PlaneLayout::cpu_alignment(stage.params.cpu_type));
+		}
+		if (!this->concurrent)
+		{
+			this->tmp_buf = TempPtr(aligned_malloc(this->getTmpSize(), this->layout.alignment), AlignedDeleter());
+		}
+	}
+
+	void check_stream() const
+	{
+		if (!this->stages.empty())
+		{
+			throw std::runtime_error("Streaming is not supported by a pipeline of several stages");
+		}
+	}
+
+	// run the filter graph with the temporary buffer of this instance,
+	// or of the calling thread for a concurrent instance or local=true
+	void process(const ZbufferC &buf_src, const Zbuffer &buf_dst, bool local = false) const
+	{
+		FilterStats::Timer timer(this->stats, FilterStats::PHASE_PROCESS);
+		if (!this->stages.empty()) // the stages of a pipeline run one after another
+		{
+			this->process_chain(buf_src, buf_dst, local);
+			return;
+		}
+		if (this->bands.size() > 1) // each band runs on a thread of the pool with a temporary buffer of its own
+		{
+			ThreadPool::global().parallel_for(this->bands.size(), [&](size_t b)
+			{
+				const Band &band = this->bands[b];
+				ZbufferC band_src = buf_src;
+				Zbuffer band_dst = buf_dst;
+				for (int p = 0; p < MAX_PLANES; ++p)
+				{
+					if (band_src.data(p))
+						band_src.data(p) = static_cast<const uint8_t *>(band_src.data(p)) + band.src_top * band_src.stride(p);
+					if (band_dst.data(p))
+						band_dst.data(p) = static_cast<uint8_t *>(band_dst.data(p)) + band.dst_top * band_dst.stride(p);
+				}
+				band.graph.process(band_src, band_dst,
+					ScratchArena::local().get(ScratchArena::SLOT_TMP, band.graph.get_tmp_size(), this->layout.alignment));
+			});
+			return;
+		}
+
+		void *tmp = this->concurrent || local
+			? ScratchArena::local().get(ScratchArena::SLOT_TMP, this->graph.get_tmp_size(), this->layout.alignment)
+			: this->tmp_buf.get();
+		this->graph.process(buf_src, buf_dst, tmp);
+	}
+
+	// run the stages of a pipeline, with the intermediate images taken from the arena
+	void process_chain(const ZbufferC &buf_src, const Zbuffer &buf_dst, bool local) const
+	{
+		ScratchArena &arena = this->getArena(local);
+		void *tmp = this->concurrent || local
+			? ScratchArena::local().get(ScratchArena::SLOT_TMP, this->getTmpSize(), this->layout.alignment)
+			: this->tmp_buf.get();
+		Zbuffer mid[2];
+
+		for (size_t k = 0; k < this->stages.size(); ++k)
+		{
+			const bool last = k + 1 == this->stages.size();
+			if (!last) // the images alternate between 2 slots
+			{
+				const Zformat &format = this->stages[k].dst_format;
+				const int slot = k % 2 ? ScratchArena::SLOT_MID1 : ScratchArena::SLOT_MID0;
+				mid[k % 2] = Zbuffer();
+				fill_planes(mid[k % 2], format, arena.get(slot, fill_planes(mid[k % 2], format, nullptr, this->layout),
+					this->layout.alignment), this->layout);
+			}
+			const ZbufferC in = k == 0 ? buf_src : mid[(k - 1) % 2].as_const();
+			const Zbuffer out = last ? buf_dst : mid[k % 2];
+			if (this->stages[k].box)
+			{
+				box_planes(this->stages[k], in, out);
+			}
+			else
+			{
+				this->chain[k].process(in, out, tmp);
+			}
+		}
+	}
+
+	// average the blocks of box x box pixels of every plane
+	static void box_planes(const Stage &stage, ZbufferC buf_src, Zbuffer buf_dst)
+	{
+		const Zformat &format = stage.dst_format;
+		const bool simd = stage.params.cpu_type != ZIMG_CPU_NONE;
+		for (int c = 0; c < plane_count(format); ++c)
+		{
+			const int p = plane_index(format, c);
+			void *dst = buf_dst.data(p);
+			const void *src = buf_src.data(p);
+			const std::ptrdiff_t dst_stride = buf_dst.stride(p);
+			const std::ptrdiff_t src_stride = buf_src.stride(p);
+			switch (format.pixel_type)
+			{
+			case ZIMG_PIXEL_BYTE:
+				box_reduce(static_cast<uint8_t *>(dst), dst_stride, static_cast<const uint8_t *>(src), src_stride,
+					stage.box, format.width, format.height, simd);
+				break;
+			case ZIMG_PIXEL_WORD:
+				box_reduce(static_cast<uint16_t *>(dst), dst_stride, static_cast<const uint16_t *>(src), src_stride,
+					stage.box, format.width, format.height, simd);
+				break;
+			case ZIMG_PIXEL_FLOAT:
+				box_reduce(static_cast<float *>(dst), dst_stride, static_cast<const float *>(src), src_stride,
+					stage.box, format.width, format.height, simd);
+				break;
+			default:
+				throw std::runtime_error("Unsupported pixel type for the area average");
+			}
+		}
+	}
+
+	// set the planes of a whole image of the format, stored one after another from base,
+	// return the size in bytes, base=nullptr only computes the size
+	static size_t fill_planes(Zbuffer &buffer, const Zformat &format, void *base,
+		const PlaneLayout &layout = PlaneLayout())
+	{
+		const size_t pixel = pixel_size(format.pixel_type);
+		size_t size = 0;
+		for (int c = 0; c < plane_count(format); ++c)
+		{
+			const bool chroma = is_chroma(format, c);
+			const unsigned sw = chroma ? format.subsample_w : 0;
+			const unsigned sh = chroma ? format.subsample_h : 0;
+			const size_t width = (format.width + (1U << sw) - 1) >> sw;
+			const size_t height = (format.height + (1U << sh) - 1) >> sh;
+			const size_t stride = layout.stride(width * pixel);
+			if (base)
+			{
+				const int index = plane_index(format, c);
+				buffer.data(index) = static_cast<uint8_t *>(base) + size;
+				buffer.stride(index) = stride;
+				buffer.mask(index) = ZIMG_BUFFER_MAX;
+			}
+			size += stride * height;
+		}
+		return size;
+	}
+
+	// format with other dimensions and the default active region
+	static Zformat with_size(const Zformat &format, unsigned width, unsigned height)
+	{
+		Zformat result = format;
+		result.width = width;
+		result.height = height;
+		result.active_region = Zformat().active_region;
+		return result;
+	}
+
+	// whether the dimensions are a multiple of the chroma subsampling
+	static bool fits(const Zformat &format)
+	{
+		return format.width % (1U << format.subsample_w) == 0 && format.height % (1U << format.subsample_h) == 0;
+	}
+
+	static double area(const Zformat &format)
+	{
+		return static_cast<double>(format.width) * format.height;
+	}
+
+	// whether the formats are the same, apart from the active region
+	static bool same_format(const Zformat &a, const Zformat &b)
+	{
+		return a.width == b.width && a.height == b.height && a.pixel_type == b.pixel_type
+			&& a.subsample_w == b.subsample_w && a.subsample_h == b.subsample_h
+			&& a.color_family == b.color_family && a.matrix_coefficients == b.matrix_coefficients
+			&& a.transfer_characteristics == b.transfer_characteristics && a.color_primaries == b.color_primaries
+			&& a.depth == b.depth && a.pixel_range == b.pixel_range
+			&& a.field_parity == b.field_parity && a.chroma_location == b.chroma_location
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+			&& a.alpha == b.alpha
+#endif
+			;
+	}
+
+	// whether the formats have the same transfer and primaries, thus only differ in matrix, range or depth
+	static bool same_light(const Zformat &a, const Zformat &b)
+	{
+		return a.transfer_characteristics == b.transfer_characteristics && a.color_primaries == b.color_primaries;
+	}
+
+	static bool same_params(const Zparams &a, const Zparams &b)
+	{
+		const auto same = [](double x, double y) { return x == y || (std::isnan(x) && std::isnan(y)); };
+		return a.resample_filter == b.resample_filter
+			&& same(a.filter_param_a, b.filter_param_a) && same(a.filter_param_b, b.filter_param_b)
+			&& a.resample_filter_uv == b.resample_filter_uv
+			&& same(a.filter_param_a_uv, b.filter_param_a_uv) && same(a.filter_param_b_uv, b.filter_param_b_uv)
+			&& a.dither_type == b.dither_type && a.cpu_type == b.cpu_type
+			&& same(a.nominal_peak_luminance, b.nominal_peak_luminance)
+#if ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4)
+			&& a.allow_approximate_gamma == b.allow_approximate_gamma
+#endif
+			;
+	}
+
+	// whether a stage only changes the dimensions
+	static bool is_resize(const Stage &stage)
+	{
+		return same_format(with_size(stage.src_format, stage.dst_format.width, stage.dst_format.height), stage.dst_format);
+	}
+
+	// whether an area average stage can run, on whole images without subsampling
+	static bool box_fits(const Stage &stage)
+	{
+		const Zformat &src = stage.src_format;
+		const Zformat &dst = stage.dst_format;
+		return (stage.box == 2 || stage.box == 4) && src.pixel_type != ZIMG_PIXEL_HALF
+			&& !src.subsample_w && !src.subsample_h && is_resize(stage)
+			&& src.width == dst.width * stage.box && src.height == dst.height * stage.box
+			&& keeps_size(Stage{ src, with_size(src, src.width, src.height), stage.params });
+	}
+
+	// whether a stage keeps the dimensions over the whole image
+	static bool keeps_size(const Stage &stage)
+	{
+		const Zformat &src = stage.src_format;
+		const auto whole = [](double value, double full) { return std::isnan(value) || value == full; };
+		return src.width == stage.dst_format.width && src.height == stage.dst_format.height
+			&& whole(src.active_region.left, 0) && whole(src.active_region.top, 0)
+			&& whole(src.active_region.width, src.width) && whole(src.active_region.height, src.height);
+	}
+
+	// state of a row callback passed through zimg
+	struct StreamContext
+	{
+		const Tcallback *callback;
+		std::exception_ptr *error;
+	};
+
+	static int stream_callback(void *user, unsigned i, unsigned left, unsigned right)
+	{
+		StreamContext *ctx = static_cast<StreamContext *>(user);
+		try
+		{
+			(*ctx->callback)(i, left, right);
+			return 0;
+		}
+		catch (...)
+		{
+			*ctx->error = std::current_exception();
+			return 1;
+		}
+	}
+
+	// whether the target rows [y0, y1) of a band map to exactly the same source positions as in the full graph
+	// both forms of the position (division by the scale and multiplication by the step) are compared
+	static bool band_exact(unsigned y0, unsigned y1, double top, double height, unsigned dst_height)
+	{
+		const unsigned rows = y1 - y0;
+		const double band_top = top + static_cast<double>(y0) * height / dst_height;
+		const double band_height = static_cast<double>(rows) * height / dst_height;
+		const double scale = dst_height / height;
+		const double band_scale = rows / band_height;
+		const double step = height / dst_height;
+		const double band_step = band_height / rows;
+
+		if (scale != band_scale || step != band_step)
+		{
+			return false;
+		}
+		for (unsigned i = 0; i < rows; ++i)
+		{
+			if ((i + 0.5) / band_scale + band_top != (y0 + i + 0.5) / scale + top
+				|| (i + 0.5) * band_step + band_top != (y0 + i + 0.5) * step + top)
+			{
+				return false;
+			}
+		}
+		return true;
 	}
 };
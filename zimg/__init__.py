@@ -1,3 +1,12 @@
 from zimg import zimg
+from zimg import pool as _pool
+_pool._configure_env()
 from zimg.format import *
 from zimg.resize import *
+from zimg.stream import *
+from zimg.pipeline import *
+from zimg.pool import *
+from zimg.warmup import *
+from zimg import warmup as _warmup
+_warmup._register_fork()
+_warmup._warm_env()
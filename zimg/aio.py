@@ -0,0 +1,73 @@
+import asyncio
+import os
+import weakref
+
+__all__ = ['call', 'wrap_future']
+
+# the tasks of ZFilter.submit write a byte into a pipe on completion, without taking the GIL,
+# and each event loop watches the read end of its own pipe to resolve the pending futures
+# loops without add_reader (such as the proactor loop on Windows) wait in an executor thread instead
+
+class _Notifier:
+    def __init__(self, loop):
+        self.loop = loop
+        self.pending = []
+        self.rfd, self.wfd = os.pipe()
+        os.set_blocking(self.rfd, False)
+        # a full pipe drops the byte instead of blocking the worker thread, the pending futures are checked anyway
+        os.set_blocking(self.wfd, False)
+        try:
+            loop.add_reader(self.rfd, self._drain)
+        except NotImplementedError:
+            os.close(self.rfd)
+            os.close(self.wfd)
+            self.rfd = self.wfd = -1
+
+    def submit(self, zfilter, src, **kwargs):
+        zfuture = zfilter.submit(src, notify_fd=self.wfd, **kwargs)
+        return self.wrap(zfuture)
+
+    def wrap(self, zfuture):
+        if self.wfd < 0:
+            return self.loop.run_in_executor(None, zfuture.result)
+        future = self.loop.create_future()
+        self.pending.append((zfuture, future))
+        # the byte may have been written before the future was queued
+        self._drain()
+        return future
+
+    def _drain(self):
+        try:
+            while os.read(self.rfd, 4096):
+                pass
+        except BlockingIOError:
+            pass
+        pending = []
+        for zfuture, future in self.pending:
+            if not zfuture.done():
+                pending.append((zfuture, future))
+            elif not future.cancelled():
+                try:
+                    future.set_result(zfuture.result())
+                except Exception as e:
+                    future.set_exception(e)
+        self.pending = pending
+
+_notifiers = weakref.WeakKeyDictionary()
+
+def _notifier(loop):
+    notifier = _notifiers.get(loop)
+    if notifier is None:
+        notifier = _notifiers[loop] = _Notifier(loop)
+    return notifier
+
+async def call(zfilter, src, **kwargs):
+    # process src on the thread pool and await the result, zfilter is a zimg.ZFilter,
+    # or a wrapper with the same submit() method (Resizer, FormatCvt)
+    # the pipe is never closed while the loop lives, so it stays valid for the pending tasks
+    return await _notifier(asyncio.get_running_loop()).submit(zfilter, src, **kwargs)
+
+def wrap_future(zfuture, loop=None):
+    # asyncio future of a zimg.ZFuture submitted without notify_fd, waited in an executor thread
+    loop = loop or asyncio.get_event_loop()
+    return loop.run_in_executor(None, zfuture.result)
@@ -1,13 +1,26 @@
 import numpy as np
 from zimg import zimg
+from zimg.stream import row_reader, row_writer
 
-__all__ = ['FormatCvt', 'convertFormat']
+__all__ = ['FormatCvt', 'convertFormat', 'FrameReader', 'FrameWriter']
+
+# memory-mapped y4m or raw planar frame files, see FormatCvt.frames
+FrameReader = zimg.FrameReader
+FrameWriter = zimg.FrameWriter
 
 # NOTE: ZIMG implement BT709, BT601, BT2020 transfer as a gamma=2.4 curve, which differs from the standards
 
-depth_map = {np.dtype('uint8'): 8, np.dtype('uint16'): 16, np.dtype('float32'): 32}
+# float16 has the depth of uint16, the HALF pixel type is selected by the dtype arguments
+depth_map = {np.dtype('uint8'): 8, np.dtype('uint16'): 16, np.dtype('float16'): 16, np.dtype('float32'): 32}
+
+def _is_half(dtype):
+    return dtype is not None and np.dtype(dtype) == np.float16
+
+# chroma subsampling as (log2 horizontal, log2 vertical)
+subsample_map = {'444': (0, 0), '422': (1, 0), '420': (1, 1), '411': (2, 0), '410': (2, 1)}
 
-def createFormat(width, height, depth, color=None, range=None, matrix=None, transfer=None, primaries=None):
+def createFormat(width, height, depth, color=None, range=None, matrix=None, transfer=None, primaries=None,
+    subsample=None, chroma=None, alpha=None, dtype=None):
     # parameters
     if color is None:
         color = 'RGB'
@@ -19,17 +32,27 @@ def createFormat(width, height, depth, color=None, range=None, matrix=None, tran
         transfer = 'BT709'
     if primaries is None:
         primaries = 'BT709'
+    if subsample is None:
+        subsample = '444'
+    if isinstance(subsample, str):
+        subsample = subsample_map[subsample]
     # create format
     f = zimg.ZFormat()
     f.width = width
     f.height = height
-    f.pixel_type = zimg.Pixel.BYTE if depth <= 8 else zimg.Pixel.WORD if depth <= 16 else zimg.Pixel.FLOAT
+    f.pixel_type = zimg.Pixel.HALF if _is_half(dtype) else \
+        zimg.Pixel.BYTE if depth <= 8 else zimg.Pixel.WORD if depth <= 16 else zimg.Pixel.FLOAT
     f.color_family = getattr(zimg.Color, color.upper())
     f.matrix_coefficients = getattr(zimg.Matrix, matrix.upper())
     f.transfer_characteristics = getattr(zimg.Transfer, transfer.upper())
     f.color_primaries = getattr(zimg.Primaries, primaries.upper())
     f.depth = depth
     f.pixel_range = getattr(zimg.Range, range.upper())
+    f.subsample_w, f.subsample_h = subsample
+    if chroma is not None:
+        f.chroma_location = getattr(zimg.Chroma, chroma.upper())
+    if alpha is not None:
+        f.alpha = getattr(zimg.Alpha, alpha.upper())
     # return format
     return f
 
@@ -37,11 +60,14 @@ class FormatCvt:
     def __init__(self, sw, sh, depth_in, dw=None, dh=None,
         filter=None, filter_a=None, filter_b=None, dither=None,
         color_in=None, range_in=None, matrix_in=None, transfer_in=None, primaries_in=None,
-        depth=None, color=None, range=None, matrix=None, transfer=None, primaries=None):
+        depth=None, color=None, range=None, matrix=None, transfer=None, primaries=None,
+        subsample_in=None, chroma_in=None, subsample=None, chroma=None, alpha_in=None, alpha=None,
+        cached=False, bands=1, dtype_in=None, dtype=None, autotune=False):
         # basic parameters
         self.sw = sw
         self.sh = sh
         self.depth_in = depth_in
+        self.half_in = _is_half(dtype_in)
         if dw is None:
             dw = self.sw
         if dh is None:
@@ -50,6 +76,8 @@ class FormatCvt:
             color_in = 'RGB' if matrix_in is None else 'RGB' if matrix_in.upper() in ('RGB', 'UNSPECIFIED') else 'YUV'
         if depth is None:
             depth = depth_in
+            if dtype is None:
+                dtype = dtype_in
         if color is None:
             color = color_in if matrix is None else 'RGB' if matrix.upper() in ('RGB', 'UNSPECIFIED') else 'YUV'
         if range is None:
@@ -60,6 +88,12 @@ class FormatCvt:
             transfer = transfer_in
         if primaries is None:
             primaries = primaries_in
+        if subsample is None and color.upper() == 'YUV':
+            subsample = subsample_in
+        if chroma is None and color.upper() == 'YUV':
+            chroma = chroma_in
+        if alpha is None:
+            alpha = alpha_in
         # create zimg params
         params = zimg.ZGraphParams()
         if filter is not None:
@@ -71,57 +105,116 @@ class FormatCvt:
         if dither is not None:
             params.dither_type = getattr(zimg.Dither, dither.upper())
         # create input format
-        src_format = createFormat(sw, sh, depth_in, color_in, range_in, matrix_in, transfer_in, primaries_in)
+        src_format = createFormat(sw, sh, depth_in, color_in, range_in, matrix_in, transfer_in, primaries_in,
+            subsample_in, chroma_in, alpha_in, dtype_in)
         # create output format
-        dst_format = createFormat(dw, dh, depth, color, range, matrix, transfer, primaries)
-        # create zimg filter
-        self.zfilter = zimg.ZFilter(src_format, dst_format, params)
+        dst_format = createFormat(dw, dh, depth, color, range, matrix, transfer, primaries,
+            subsample, chroma, alpha, dtype)
+        # create zimg filter, or share the one from the process-wide cache
+        # cached filters are single-band, bands != 1 splits each image into row bands processed in parallel
+        # autotune=True takes the fastest cpu type measured on this CPU, see zimg.autotune_file()
+        if cached and bands == 1:
+            self.zfilter = zimg.cache_filter(src_format, dst_format, params, autotune=autotune)
+        else:
+            self.zfilter = zimg.ZFilter(src_format, dst_format, params, bands=bands, autotune=autotune)
 
-    def __call__(self, src, channel_first=False):
-        # check input format
+    def _check(self, src, channel_first):
+        # DLPack producers (such as CPU tensors) and buffers are viewed as NumPy arrays, without a copy
+        view = zimg.array_view(src)
+        if view is not None:
+            src = view
+        # check input format, rank 4 is a batch of images (NCHW or NHWC)
         depth_in = depth_map.get(src.dtype)
         rank = len(src.shape)
         if rank == 2:
             channel_first = True
-        elif rank != 3:
-            raise ValueError('the rank ({}) of the input should be either 2 or 3.'.format(rank))
+        elif rank not in (3, 4):
+            raise ValueError('the rank ({}) of the input should be 2, 3 or 4.'.format(rank))
         sw = src.shape[-1 if channel_first else -2]
         sh = src.shape[-2 if channel_first else -3]
         if depth_in != self.depth_in:
             raise ValueError('input depth {} not match the desired {}'.format(depth_in, self.depth_in))
+        if (src.dtype == np.float16) != self.half_in:
+            raise ValueError('input data type {} not match the desired {}'.format(src.dtype, 'float16' if self.half_in else 'integer'))
         if sw != self.sw or sh != self.sh:
             raise ValueError('input size {}x{} not match the desired {}x{}'.format(sw, sh, self.sw, self.sh))
-        # apply filter
-        if rank == 3 and not channel_first:
-            src = np.transpose(src, (2, 0, 1))
-        dst = self.zfilter(src)
-        if rank == 3 and not channel_first:
-            dst = np.transpose(dst, (1, 2, 0))
+        return src, channel_first
+
+    def __call__(self, src, channel_first=False, threads=1, out=None):
+        src, channel_first = self._check(src, channel_first)
+        # apply filter, HWC data is (de)interleaved natively
+        # the result is written into out when provided, instead of a new array, out must not share memory with src
+        dst = self.zfilter(src, channel_first, threads, out)
         # return
         return dst
 
+    def submit(self, src, channel_first=False, out=None, notify_fd=-1):
+        # queue the processing on the thread pool, return a zimg.ZFuture of the result
+        # the GIL is not held by the task, see zimg.aio to await it from asyncio
+        src, channel_first = self._check(src, channel_first)
+        return self.zfilter.submit(src, channel_first, out, notify_fd)
+
+    def tiled(self, src, tile_width=512, tile_height=512, channel_first=False, threads=1, out=None):
+        # process a single image tile by tile, each reading only the source window its filter needs,
+        # src and out may be numpy.memmap arrays, threads != 1 spreads the tiles across the thread pool
+        src, channel_first = self._check(src, channel_first)
+        if len(src.shape) == 4:
+            raise ValueError('tiled processing takes a single image, not a batch')
+        return self.zfilter.tiled(src, tile_width, tile_height, channel_first, threads, out)
+
+    def stream(self, reader, writer, channel_first=False):
+        # process row by row, so that neither image has to be entirely in memory
+        # reader(i) and writer(i, left, row) are callables, or binary file-like objects of packed rows
+        reader = row_reader(reader, self.zfilter.src_format, channel_first)
+        writer = row_writer(writer, self.zfilter.dst_format, channel_first)
+        self.zfilter.stream(reader, writer, channel_first)
+
+    def frames(self, reader, writer, first=0, count=0):
+        # convert the frames of a FrameReader into a FrameWriter, in place in the mapped files,
+        # the writer format should be self.zfilter.dst_format, count=0 converts all the following frames
+        return self.zfilter.frames(reader, writer, first, count)
+
+    def planes(self, planes):
+        # process a sequence of 2-D arrays, one per plane, chroma planes are sized after the subsampling
+        return self.zfilter.planes(planes)
+
+    def packed(self, src, layout='i420'):
+        # process a single continuous buffer, 'i420' stores the planes one after another,
+        # 'nv12' stores the chroma planes interleaved in a single plane
+        layout = layout.lower()
+        if layout not in ('i420', 'nv12'):
+            raise ValueError('Unsupported layout {}, must be i420 or nv12'.format(layout))
+        return self.zfilter.packed(src, layout == 'nv12')
+
     @classmethod
     def create(cls, src, *args, channel_first=False, **kwargs):
-        # parameters
+        # parameters, DLPack producers and buffers are described by their NumPy view
+        view = zimg.array_view(src)
+        if view is not None:
+            src = view
         depth_in = depth_map.get(src.dtype)
         if depth_in is None:
-            raise ValueError('Unsupported data type {}, must be uint8, uint16 or float32'.format(src.dtype))
+            raise ValueError('Unsupported data type {}, must be uint8, uint16, float16 or float32'.format(src.dtype))
         rank = len(src.shape)
         if rank == 2:
             channels = 1
             channel_first = True
-        elif rank == 3:
+        elif rank in (3, 4):
             channels = src.shape[-3 if channel_first else -1]
         else:
-            raise ValueError('the rank ({}) of the input should be either 2 or 3.'.format(rank))
+            raise ValueError('the rank ({}) of the input should be 2, 3 or 4.'.format(rank))
         sw = src.shape[-1 if channel_first else -2]
         sh = src.shape[-2 if channel_first else -3]
-        # decide color family if not provided
+        # decide color family and alpha if not provided, 2 and 4 channels have straight alpha
         if 'color_in' not in kwargs:
-            kwargs['color_in'] = 'GREY' if channels == 1 else None
+            kwargs['color_in'] = 'GREY' if channels <= 2 else None
+        if 'alpha_in' not in kwargs and channels in (2, 4):
+            kwargs['alpha_in'] = 'STRAIGHT'
+        kwargs.setdefault('dtype_in', src.dtype)
         # return ZimgFilter instance
         return cls(sw, sh, depth_in, *args, **kwargs)
 
 def convertFormat(src, *args, channel_first=False, **kwargs):
+    kwargs.setdefault('cached', True)
     converter = FormatCvt.create(src, *args, channel_first=channel_first, **kwargs)
     return converter(src, channel_first=channel_first)
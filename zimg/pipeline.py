@@ -0,0 +1,67 @@
+from zimg import zimg
+
+__all__ = ['ZPipeline', 'FrameProcessor']
+
+class ZPipeline:
+    # run a chain of Resizer, FormatCvt or zimg.ZFilter stages as a single filter,
+    # without intermediate NumPy arrays, each stage should output the format the next one takes
+    # reorder=True resizes before a conversion when downscaling, and after it when upscaling,
+    # except around conversions changing the transfer or primaries
+    # fuse=True merges adjacent stages with the same params into a single filter graph
+    # both change the intermediate rounding, thus the output is not bit-exact with running the stages one by one
+    def __init__(self, stages, reorder=True, fuse=True, bands=1):
+        filters = [getattr(stage, 'zfilter', stage) for stage in stages]
+        if not filters:
+            raise ValueError('the pipeline requires at least one stage')
+        self.zfilter = zimg.ZFilter(filters, reorder, fuse, bands=bands)
+
+    @property
+    def stages(self):
+        # (src_format, dst_format, params, box) of the stages actually run, box > 1 is an area average
+        return self.zfilter.stages
+
+    def __call__(self, src, channel_first=False, threads=1, out=None):
+        # rank 4 is a batch of images (NCHW or NHWC), the native filter checks the input
+        if len(src.shape) == 2:
+            channel_first = True
+        return self.zfilter(src, channel_first, threads, out)
+
+    def submit(self, src, channel_first=False, out=None, notify_fd=-1):
+        # queue the processing on the thread pool, return a zimg.ZFuture of the result
+        if len(src.shape) == 2:
+            channel_first = True
+        return self.zfilter.submit(src, channel_first, out, notify_fd)
+
+    def planes(self, planes):
+        # process a sequence of 2-D arrays, one per plane, chroma planes are sized after the subsampling
+        return self.zfilter.planes(planes)
+
+    def packed(self, src, layout='i420'):
+        # process a single continuous buffer, 'i420' stores the planes one after another,
+        # 'nv12' stores the chroma planes interleaved in a single plane
+        layout = layout.lower()
+        if layout not in ('i420', 'nv12'):
+            raise ValueError('Unsupported layout {}, must be i420 or nv12'.format(layout))
+        return self.zfilter.packed(src, layout == 'nv12')
+
+class FrameProcessor:
+    # push frames of the same geometry through a Resizer, FormatCvt, ZPipeline or zimg.ZFilter stage,
+    # each frame holds one of the `buffers` rotating aligned buffer sets until it is popped, in order
+    # staged=True overlaps the copy-in, processing and copy-out of consecutive frames on 3 worker threads
+    def __init__(self, stage, buffers=3, staged=True):
+        self.zprocessor = zimg.ZFrameProcessor(getattr(stage, 'zfilter', stage), buffers, staged)
+
+    @property
+    def pending(self):
+        # number of frames pushed and not popped yet, at most buffers
+        return self.zprocessor.pending
+
+    def push(self, src, channel_first=False, out=None):
+        # the result is written into out when provided, instead of a new array, out must not share memory with src
+        if len(src.shape) == 2:
+            channel_first = True
+        self.zprocessor.push(src, channel_first, out)
+
+    def pop(self):
+        # wait for the oldest frame, the GIL is released meanwhile
+        return self.zprocessor.pop()
@@ -0,0 +1,56 @@
+import os
+from zimg import zimg
+
+__all__ = ['configure_pool', 'pool_info', 'numa_nodes']
+
+# environment variables read when the package is imported, before anything uses the pool
+POOL_THREADS_ENV = 'ZIMG_POOL_THREADS'
+POOL_AFFINITY_ENV = 'ZIMG_POOL_AFFINITY'
+POOL_FIRST_TOUCH_ENV = 'ZIMG_POOL_FIRST_TOUCH'
+
+pool_info = zimg.pool_info
+numa_nodes = zimg.numa_nodes
+
+def _parse_cpus(text):
+    # '0-3,8' -> [0, 1, 2, 3, 8]
+    cpus = []
+    for item in text.split(','):
+        item = item.strip()
+        if not item:
+            continue
+        first, _, last = item.partition('-')
+        cpus.extend(range(int(first), int(last or first) + 1))
+    return cpus
+
+def _affinity(affinity):
+    # 'nodes' runs the workers on the CPUs of each NUMA node in turn,
+    # 'cores' pins each worker to a single CPU, alternating between the nodes,
+    # otherwise a list of CPU lists, or a string of them separated by ';' such as '0-7;8-15'
+    if affinity is None or affinity == 'none':
+        return []
+    nodes = zimg.numa_nodes()
+    if affinity == 'nodes':
+        return nodes
+    if affinity == 'cores':
+        cpus = []
+        for k in range(max(len(node) for node in nodes)):
+            cpus.extend([node[k]] for node in nodes if k < len(node))
+        return cpus
+    if isinstance(affinity, str):
+        return [_parse_cpus(item) for item in affinity.split(';') if item.strip()]
+    return [list(cpus) for cpus in affinity]
+
+def configure_pool(threads=0, affinity=None, first_touch=False):
+    # set up the thread pool shared by every parallel mode (threads != 1, bands, crops, tiles, pyramids, submit)
+    # threads counts the calling thread, 0 means one per hardware thread
+    # first_touch=True makes each thread write its scratch memory as soon as it is allocated,
+    # so that pinned workers keep it on their own NUMA node
+    # raise an error once the pool was used, thus it should be called before processing
+    zimg.pool_configure(threads, _affinity(affinity), first_touch)
+
+def _configure_env():
+    threads = os.environ.get(POOL_THREADS_ENV)
+    affinity = os.environ.get(POOL_AFFINITY_ENV)
+    first_touch = os.environ.get(POOL_FIRST_TOUCH_ENV)
+    if threads or affinity or first_touch:
+        configure_pool(int(threads or 0), affinity or None, first_touch not in (None, '', '0'))
@@ -1,74 +1,138 @@
 import numpy as np
 from zimg import zimg
+from zimg.stream import row_reader, row_writer
 
-__all__ = ['Resizer', 'scale', 'resize']
+__all__ = ['Resizer', 'Pyramid', 'scale', 'resize', 'crops', 'pyramid']
 
-depth_map = {np.dtype('uint8'): 8, np.dtype('uint16'): 16, np.dtype('float32'): 32}
+# float16 has the depth of uint16, the HALF pixel type is selected by the dtype argument
+depth_map = {np.dtype('uint8'): 8, np.dtype('uint16'): 16, np.dtype('float16'): 16, np.dtype('float32'): 32}
+
+def _params(depth, channels, half, filter, filter_a, filter_b, dither, alpha, prereduce):
+    # create zimg params
+    params = zimg.ZResizeParams.build(channels, depth)
+    if half:
+        params.pixel_type = zimg.Pixel.HALF
+    if filter is not None:
+        params.filter = getattr(zimg.Resample, filter.upper())
+    if filter_a is not None:
+        params.filter_a = filter_a
+    if filter_b is not None:
+        params.filter_b = filter_b
+    if dither is not None:
+        params.dither_type = getattr(zimg.Dither, dither.upper())
+    # 2 and 4 channels have straight alpha by default
+    if alpha is not None:
+        params.alpha = getattr(zimg.Alpha, alpha.upper())
+    # prereduce=2 or 4 averages blocks of up to 4x4 pixels before the filter for large downscales,
+    # which is faster but slightly softer, see zimg.ZResizeParams.prereduce
+    # it is skipped with straight alpha, and when it applies the filter keeps a single band whatever bands is
+    params.prereduce = prereduce
+    return params
 
 class Resizer:
     def __init__(self, depth, channels, sw, sh, dw, dh,
         filter=None, filter_a=None, filter_b=None, dither=None,
-        roi_left=0, roi_top=0, roi_width=0, roi_height=0):
+        roi_left=0, roi_top=0, roi_width=0, roi_height=0, cached=False, bands=1, alpha=None, prereduce=0, dtype=None,
+        autotune=False):
         self.depth = depth
+        self.half = dtype is not None and np.dtype(dtype) == np.float16
         self.channels = channels
         self.sw = sw
         self.sh = sh
-        # create zimg params
-        params = zimg.ZResizeParams.build(channels, depth)
-        if filter is not None:
-            params.filter = getattr(zimg.Resample, filter.upper())
-        if filter_a is not None:
-            params.filter_a = filter_a
-        if filter_b is not None:
-            params.filter_b = filter_b
-        if dither is not None:
-            params.dither_type = getattr(zimg.Dither, dither.upper())
-        # create zimg filter
-        self.zfilter = zimg.ZFilter(params, sw, sh, dw, dh,
-            roi_left, roi_top, roi_width, roi_height)
+        params = _params(depth, channels, self.half, filter, filter_a, filter_b, dither, alpha, prereduce)
+        # create zimg filter, or share the one from the process-wide cache
+        # cached filters are single-band single graphs, bands != 1 splits each image into row bands processed in parallel
+        # autotune=True takes the fastest cpu type measured on this CPU, see zimg.autotune_file()
+        if cached and bands == 1 and prereduce <= 1:
+            self.zfilter = zimg.cache_resizer(params, sw, sh, dw, dh,
+                roi_left, roi_top, roi_width, roi_height, autotune=autotune)
+        else:
+            self.zfilter = zimg.ZFilter(params, sw, sh, dw, dh,
+                roi_left, roi_top, roi_width, roi_height, bands=bands, autotune=autotune)
     
-    def __call__(self, src, channel_first=False):
-        # check input format
+    def _check(self, src, channel_first):
+        # DLPack producers (such as CPU tensors) and buffers are viewed as NumPy arrays, without a copy
+        view = zimg.array_view(src)
+        if view is not None:
+            src = view
+        # check input format, rank 4 is a batch of images (NCHW or NHWC)
         depth = depth_map.get(src.dtype)
         rank = len(src.shape)
         if rank == 2:
             channels = 1
             channel_first = True
-        elif rank == 3:
+        elif rank in (3, 4):
             channels = src.shape[-3 if channel_first else -1]
         else:
-            raise ValueError('the rank ({}) of the input should be either 2 or 3.'.format(rank))
+            raise ValueError('the rank ({}) of the input should be 2, 3 or 4.'.format(rank))
         sw = src.shape[-1 if channel_first else -2]
         sh = src.shape[-2 if channel_first else -3]
         if depth != self.depth:
             raise ValueError('input depth {} not match the desired {}'.format(depth, self.depth))
+        if (src.dtype == np.float16) != self.half:
+            raise ValueError('input data type {} not match the desired {}'.format(src.dtype, 'float16' if self.half else 'integer'))
         if channels != self.channels:
             raise ValueError('input channels {} not match the desired {}'.format(channels, self.channels))
         if sw != self.sw or sh != self.sh:
             raise ValueError('input size {}x{} not match the desired {}x{}'.format(sw, sh, self.sw, self.sh))
-        # apply filter
-        if rank == 3 and not channel_first:
-            src = np.transpose(src, (2, 0, 1))
-        dst = self.zfilter(src)
-        if rank == 3 and not channel_first:
-            dst = np.transpose(dst, (1, 2, 0))
+        return src, channel_first
+
+    def __call__(self, src, channel_first=False, threads=1, out=None):
+        src, channel_first = self._check(src, channel_first)
+        # apply filter, HWC data is (de)interleaved natively
+        # the result is written into out when provided, instead of a new array, out must not share memory with src
+        dst = self.zfilter(src, channel_first, threads, out)
         # return
         return dst
 
+    def submit(self, src, channel_first=False, out=None, notify_fd=-1):
+        # queue the processing on the thread pool, return a zimg.ZFuture of the result
+        # the GIL is not held by the task, see zimg.aio to await it from asyncio
+        src, channel_first = self._check(src, channel_first)
+        return self.zfilter.submit(src, channel_first, out, notify_fd)
+
+    def tiled(self, src, tile_width=512, tile_height=512, channel_first=False, threads=1, out=None):
+        # process a single image tile by tile, each reading only the source window its filter needs,
+        # src and out may be numpy.memmap arrays, threads != 1 spreads the tiles across the thread pool
+        src, channel_first = self._check(src, channel_first)
+        if len(src.shape) == 4:
+            raise ValueError('tiled processing takes a single image, not a batch')
+        return self.zfilter.tiled(src, tile_width, tile_height, channel_first, threads, out)
+
+    def crops(self, src, rois, channel_first=False, threads=1, out=None):
+        # resize many (left, top, width, height) regions of one source image to dw x dh in one call,
+        # return a batch of the crops, NCHW with channel_first=True and NHWC otherwise, roi_* are ignored
+        # threads != 1 spreads the crops across the thread pool, out is an optional array to write into
+        src, channel_first = self._check(src, channel_first)
+        if len(src.shape) == 4:
+            raise ValueError('crops take a single source image, not a batch')
+        return self.zfilter.crops(src, rois, channel_first, threads, out)
+
+    def stream(self, reader, writer, channel_first=False):
+        # process row by row, so that neither image has to be entirely in memory
+        # reader(i) and writer(i, left, row) are callables, or binary file-like objects of packed rows
+        reader = row_reader(reader, self.zfilter.src_format, channel_first)
+        writer = row_writer(writer, self.zfilter.dst_format, channel_first)
+        self.zfilter.stream(reader, writer, channel_first)
+
     @classmethod
     def create(cls, src, dw, dh, *args, channel_first=False, **kwargs):
-        # parameters
+        # parameters, DLPack producers and buffers are described by their NumPy view
+        view = zimg.array_view(src)
+        if view is not None:
+            src = view
         depth = depth_map.get(src.dtype)
         if depth is None:
-            raise ValueError('Unsupported data type {}, must be uint8, uint16 or float32'.format(src.dtype))
+            raise ValueError('Unsupported data type {}, must be uint8, uint16, float16 or float32'.format(src.dtype))
         rank = len(src.shape)
         if rank == 2:
             channels = 1
             channel_first = True
-        elif rank == 3:
+        elif rank in (3, 4):
             channels = src.shape[-3 if channel_first else -1]
         sw = src.shape[-1 if channel_first else -2]
         sh = src.shape[-2 if channel_first else -3]
+        kwargs.setdefault('dtype', src.dtype)
         # return ZimgFilter instance
         return cls(depth, channels, sw, sh, dw, dh, *args, **kwargs)
     
@@ -84,9 +148,65 @@ class Resizer:
         return cls.create(src, dw, dh, *args, channel_first=channel_first, **kwargs)
 
 def scale(src, scale, *args, channel_first=False, **kwargs):
+    kwargs.setdefault('cached', True)
     resizer = Resizer.createScale(src, scale, *args, channel_first=channel_first, **kwargs)
     return resizer(src, channel_first=channel_first)
 
 def resize(src, dw, dh, *args, channel_first=False, **kwargs):
+    kwargs.setdefault('cached', True)
     resizer = Resizer.create(src, dw, dh, *args, channel_first=channel_first, **kwargs)
     return resizer(src, channel_first=channel_first)
+
+def crops(src, rois, dw, dh, *args, channel_first=False, threads=1, **kwargs):
+    # resize many (left, top, width, height) regions of src to dw x dh, see Resizer.crops
+    kwargs.setdefault('cached', True)
+    resizer = Resizer.create(src, dw, dh, *args, channel_first=channel_first, **kwargs)
+    return resizer.crops(src, rois, channel_first=channel_first, threads=threads)
+
+class Pyramid:
+    # levels of halved dimensions (rounded up) of sw x sh images, each resized from the previous level,
+    # or from the source with from_source=True, which is sharper and can spread the levels across threads
+    def __init__(self, depth, channels, sw, sh, levels,
+        filter=None, filter_a=None, filter_b=None, dither=None, alpha=None, prereduce=0, dtype=None,
+        from_source=False):
+        self.depth = depth
+        self.half = dtype is not None and np.dtype(dtype) == np.float16
+        self.channels = channels
+        self.sw = sw
+        self.sh = sh
+        params = _params(depth, channels, self.half, filter, filter_a, filter_b, dither, alpha, prereduce)
+        self.zfilter = zimg.ZPyramid(params, sw, sh, levels, from_source)
+
+    @property
+    def sizes(self):
+        # (width, height) of the levels
+        return self.zfilter.sizes
+
+    def __call__(self, src, channel_first=False, threads=1):
+        # return the list of the levels, in the layout of the source, checked as a Resizer input
+        src, channel_first = Resizer._check(self, src, channel_first)
+        if len(src.shape) == 4:
+            raise ValueError('pyramids take a single source image, not a batch')
+        return self.zfilter(src, channel_first, threads)
+
+    @classmethod
+    def create(cls, src, levels, *args, channel_first=False, **kwargs):
+        view = zimg.array_view(src)
+        if view is not None:
+            src = view
+        depth = depth_map.get(src.dtype)
+        if depth is None:
+            raise ValueError('Unsupported data type {}, must be uint8, uint16, float16 or float32'.format(src.dtype))
+        if len(src.shape) == 2:
+            channels = 1
+            channel_first = True
+        else:
+            channels = src.shape[-3 if channel_first else -1]
+        sw = src.shape[-1 if channel_first else -2]
+        sh = src.shape[-2 if channel_first else -3]
+        kwargs.setdefault('dtype', src.dtype)
+        return cls(depth, channels, sw, sh, levels, *args, **kwargs)
+
+def pyramid(src, levels, *args, channel_first=False, threads=1, **kwargs):
+    # levels of halved dimensions of src, see Pyramid
+    return Pyramid.create(src, levels, *args, channel_first=channel_first, **kwargs)(src, channel_first, threads)
@@ -0,0 +1,58 @@
+import numpy as np
+from zimg import zimg
+
+__all__ = ['row_reader', 'row_writer']
+
+dtype_map = {zimg.Pixel.BYTE: np.dtype('uint8'), zimg.Pixel.WORD: np.dtype('uint16'),
+    zimg.Pixel.HALF: np.dtype('float16'), zimg.Pixel.FLOAT: np.dtype('float32')}
+
+def _row_shape(format, channel_first):
+    # shape of a row of the format, as passed to ZFilter.stream
+    channels = 1 if format.color_family == zimg.Color.GREY else 3
+    if channels == 1:
+        return (format.width,)
+    if channel_first:
+        raise ValueError('file-like objects hold packed rows, channel_first should be False')
+    return (format.width, channels)
+
+def row_reader(src, format, channel_first=False):
+    # a callable is used as it is, a binary file-like object is read as packed (HWC) rows
+    # seeking is only required when rows are not read in order
+    if callable(src):
+        return src
+    shape = _row_shape(format, channel_first)
+    dtype = dtype_map[format.pixel_type]
+    row_size = int(np.prod(shape)) * dtype.itemsize
+    base = src.tell() if src.seekable() else 0
+    pos = base
+    def read(i):
+        nonlocal pos
+        offset = base + i * row_size
+        if offset != pos:
+            src.seek(offset)
+        data = src.read(row_size)
+        if len(data) != row_size:
+            raise EOFError('row {} is out of the input file'.format(i))
+        pos = offset + row_size
+        return np.frombuffer(data, dtype).reshape(shape)
+    return read
+
+def row_writer(dst, format, channel_first=False):
+    # a callable is used as it is, a binary file-like object is written as packed (HWC) rows
+    # seeking is only required when rows are written in several column tiles
+    if callable(dst):
+        return dst
+    shape = _row_shape(format, channel_first)
+    dtype = dtype_map[format.pixel_type]
+    pixel_size = int(np.prod(shape[1:])) * dtype.itemsize
+    row_size = shape[0] * pixel_size
+    base = dst.tell() if dst.seekable() else 0
+    pos = base
+    def write(i, left, row):
+        nonlocal pos
+        offset = base + i * row_size + left * pixel_size
+        if offset != pos:
+            dst.seek(offset)
+        dst.write(row.data)
+        pos = offset + row.nbytes
+    return write
@@ -0,0 +1,47 @@
+import json
+import os
+from zimg import zimg
+from zimg.format import FormatCvt
+from zimg.resize import Resizer
+
+__all__ = ['warm', 'warm_file']
+
+# environment variable naming a config file loaded when the package is imported
+WARM_CONFIG_ENV = 'ZIMG_WARM_CONFIG'
+
+_builders = {'resize': Resizer, 'format': FormatCvt}
+
+def warm(configs):
+    # build filters into the process-wide cache, so that the later Resizer/FormatCvt created with cached=True,
+    # and resize()/scale()/convertFormat(), get them without building their graphs again
+    # warming before forking the workers shares the filters with them copy-on-write
+    # each config is {'resize': {Resizer arguments}} or {'format': {FormatCvt arguments}}
+    # return the list of the built Resizer/FormatCvt objects
+    entries = []
+    for config in configs:
+        if len(config) != 1 or next(iter(config)) not in _builders:
+            raise ValueError('each config should have a single key among {}'.format(', '.join(_builders)))
+        kind, kwargs = next(iter(config.items()))
+        entries.append((_builders[kind], dict(kwargs, cached=True)))
+    # keep all of them in the cache
+    stats = zimg.cache_stats()
+    if stats['capacity'] < stats['size'] + len(entries):
+        zimg.cache_set_capacity(stats['size'] + len(entries))
+    return [builder(**kwargs) for builder, kwargs in entries]
+
+def warm_file(path):
+    # warm the cache from a JSON file holding a list of configs, see warm()
+    with open(path) as f:
+        return warm(json.load(f))
+
+def _warm_env():
+    path = os.environ.get(WARM_CONFIG_ENV)
+    if path:
+        warm_file(path)
+
+def _register_fork():
+    # the locks of the cache, the tuner and the pool settings are held across a fork,
+    # and the child gets a thread pool of its own
+    if hasattr(os, 'register_at_fork'):
+        os.register_at_fork(before=zimg._fork_prepare,
+            after_in_parent=zimg._fork_parent, after_in_child=zimg._fork_child)